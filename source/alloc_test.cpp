@@ -0,0 +1,265 @@
+// notes_alloc_test: counts the free-store allocations behind the claim in main.cpp that a Small_any keeps a value that fits
+// inside itself, with no allocation (and that std::any, in libstdc++, doesn't)
+
+// the count comes from replacing the global operator new and operator delete (every form: plain and array, nothrow,
+// aligned, sized), which is a decision for the whole program; that's why it's a program of its own,
+// so the benchmarks in main.cpp and bench.cpp allocate the usual way
+// Small_any below is the one from main.cpp
+
+// usage: notes_alloc_test
+// prints each case's count, and exits with 1 if a case allocated a different number of times than claimed
+
+#include <any>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+atomic<long> allocations {0};
+
+void* counted_alloc(size_t n)
+{
+    allocations.fetch_add(1,memory_order_relaxed);
+    return malloc(n ? n : 1);
+}
+
+void* counted_aligned_alloc(size_t n, align_val_t al)
+{
+    allocations.fetch_add(1,memory_order_relaxed);
+    size_t a = static_cast<size_t>(al);
+#if defined(_MSC_VER)
+    return _aligned_malloc(n ? n : 1,a);
+#else
+    return aligned_alloc(a,n ? (n+a-1)/a*a : a); // aligned_alloc wants a multiple of the alignment
+#endif
+}
+
+void aligned_free(void* p)
+{
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+} // namespace
+
+void* operator new(size_t n)
+{
+    if (void* p = counted_alloc(n)) return p;
+    throw bad_alloc{};
+}
+void* operator new[](size_t n) { return operator new(n); }
+void* operator new(size_t n, const nothrow_t&) noexcept { return counted_alloc(n); }
+void* operator new[](size_t n, const nothrow_t&) noexcept { return counted_alloc(n); }
+void* operator new(size_t n, align_val_t al)
+{
+    if (void* p = counted_aligned_alloc(n,al)) return p;
+    throw bad_alloc{};
+}
+void* operator new[](size_t n, align_val_t al) { return operator new(n,al); }
+void* operator new(size_t n, align_val_t al, const nothrow_t&) noexcept { return counted_aligned_alloc(n,al); }
+void* operator new[](size_t n, align_val_t al, const nothrow_t&) noexcept { return counted_aligned_alloc(n,al); }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { aligned_free(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { aligned_free(p); }
+
+template<typename T>
+struct Type_tag {
+    static constexpr char tag = 0;
+};
+
+template<typename T>
+constexpr const void* type_id_of = &Type_tag<T>::tag; // a different address for each T
+
+template<size_t Size = 32, bool Copyable = true>
+class Small_any {
+public:
+    Small_any() = default;
+
+    template<typename T>
+        requires (!is_same_v<decay_t<T>,Small_any> && (!Copyable || copy_constructible<decay_t<T>>))
+    Small_any(T&& x) { emplace<decay_t<T>>(forward<T>(x)); }
+
+    Small_any(const Small_any& a) requires Copyable
+    {
+        if (a.ops) a.ops->copy(a,*this);
+    }
+    Small_any(Small_any&& a) noexcept
+    {
+        if (a.ops) a.ops->move(a,*this);
+    }
+    Small_any& operator=(const Small_any& a) requires Copyable
+    {
+        if (this!=&a) {
+            Small_any tmp {a}; // if the copy throws, *this is unchanged
+            *this = move(tmp);
+        }
+        return *this;
+    }
+    Small_any& operator=(Small_any&& a) noexcept
+    {
+        if (this!=&a) {
+            reset();
+            if (a.ops) a.ops->move(a,*this);
+        }
+        return *this;
+    }
+    ~Small_any() { reset(); }
+
+    template<typename T, typename... Args>
+    T& emplace(Args&&... args)
+    {
+        reset();
+        T* p;
+        if constexpr (fits_inline<T>)
+            p = new(buf) T(forward<Args>(args)...);
+        else
+            heap = p = new T(forward<Args>(args)...);
+        ops = &ops_for<T>;
+        return *p;
+    }
+
+    void reset() noexcept
+    {
+        if (ops) {
+            ops->destroy(*this);
+            ops = nullptr;
+        }
+    }
+
+    bool has_value() const { return ops!=nullptr; }
+    const void* type() const { return ops ? ops->type : nullptr; } // compare with type_id_of<T>
+
+    template<typename T>
+    T* get_if() { return ops && ops->type==type_id_of<T> ? ptr<T>() : nullptr; } // like any_cast<T>(&a)
+    template<typename T>
+    const T* get_if() const { return ops && ops->type==type_id_of<T> ? ptr<T>() : nullptr; }
+
+    template<typename T>
+    T& get() // like any_cast<T&>(a)
+    {
+        if (T* p = get_if<T>()) return *p;
+        throw bad_any_cast{};
+    }
+    template<typename T>
+    const T& get() const
+    {
+        if (const T* p = get_if<T>()) return *p;
+        throw bad_any_cast{};
+    }
+
+    template<typename T>
+    static constexpr bool fits_inline = sizeof(T)<=Size && alignof(T)<=alignof(max_align_t) && is_nothrow_move_constructible_v<T>;
+private:
+    struct Ops { // one for each type held
+        const void* type;
+        void (*destroy)(Small_any&) noexcept;
+        void (*copy)(const Small_any& from, Small_any& to); // nullptr for a move-only Small_any
+        void (*move)(Small_any& from, Small_any& to) noexcept; // leaves from empty
+    };
+
+    template<typename T>
+    T* ptr() { if constexpr (fits_inline<T>) return std::launder(reinterpret_cast<T*>(buf)); else return static_cast<T*>(heap); }
+    template<typename T>
+    const T* ptr() const { return const_cast<Small_any*>(this)->ptr<T>(); }
+
+    template<typename T>
+    static constexpr Ops ops_for {
+        type_id_of<T>,
+        [](Small_any& a) noexcept {
+            if constexpr (fits_inline<T>) a.ptr<T>()->~T();
+            else delete a.ptr<T>();
+        },
+        [] {
+            void (*copy)(const Small_any&, Small_any&) = nullptr;
+            if constexpr (Copyable)
+                copy = [](const Small_any& from, Small_any& to) { to.emplace<T>(*from.ptr<T>()); };
+            return copy;
+        }(),
+        [](Small_any& from, Small_any& to) noexcept {
+            if constexpr (fits_inline<T>) {
+                new(to.buf) T(std::move(*from.ptr<T>()));
+                from.ptr<T>()->~T();
+            }
+            else
+                to.heap = from.heap; // just take the pointer
+            to.ops = from.ops;
+            from.ops = nullptr;
+        },
+    };
+
+    const Ops* ops = nullptr; // nullptr: empty
+    union {
+        alignas(max_align_t) byte buf[Size];
+        void* heap;
+    };
+};
+
+using Unique_any = Small_any<32,false>; // move-only
+
+static_assert(Small_any<>::fits_inline<string>); // libstdc++ and libc++: a 32-byte (or smaller) string
+static_assert(Unique_any::fits_inline<unique_ptr<int>>);
+
+// the allocations f() makes, apart from any made before it starts
+template<typename F>
+long count_allocations(F f)
+{
+    long before = allocations.load(memory_order_relaxed);
+    f();
+    return allocations.load(memory_order_relaxed)-before;
+}
+
+int main()
+{
+    int failures = 0;
+    auto expect = [&failures](const char* label, long expected, long counted) {
+        cout << label << counted << " allocations" << (counted==expected ? "\n" : " (claimed: "+to_string(expected)+")\n");
+        if (counted!=expected) ++failures;
+    };
+
+    const string fish = "Herring"; // short enough not to need an allocation of its own
+    expect("string (SSO):                  ",0,count_allocations([&] { string s = fish; }));
+
+    expect("Small_any: make, copy, move:   ",0,count_allocations([&] {
+        Small_any<> a = fish;
+        Small_any<> b = a;
+        Small_any<> c = move(b);
+        a = c;
+    }));
+    expect("Unique_any: make, move:        ",0,count_allocations([&] {
+        Unique_any a = fish;
+        Unique_any b = move(a);
+        Unique_any c;
+        c = move(b);
+    }));
+    expect("Unique_any: unique_ptr<int>:   ",1,count_allocations([&] { Unique_any u = make_unique<int>(7); })); // the int; the pointer is inline
+    expect("Small_any<8>: too big, make:   ",1,count_allocations([&] { Small_any<8> a = fish; }));
+    expect("Small_any<8>: move:            ",0,[&] {
+        Small_any<8> a = fish;
+        return count_allocations([&] { Small_any<8> b = move(a); }); // takes the pointer
+    }());
+    long any_count = count_allocations([&] { any a = fish; any b = a; });
+    cout << "any: make, copy:               " << any_count << " allocations (libstdc++: 2, one per any)\n";
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,445 @@
+// notes_bench: measurements for the performance claims made in main.cpp
+// each claim (quoted from the notes) gets its benchmarks side by side, so a regression shows up as a number instead of an opinion
+
+// the harness:
+//   calibration: a repetition runs the benchmark's batch often enough to take at least 10ms
+//   warmup: a few untimed repetitions first (caches, branch predictors, page faults, CPU frequency)
+//   statistics: min, median, mean, standard deviation, and max over the timed repetitions, in ns per item
+//   hardware counters: cycles, instructions, and cache misses per item, from perf_event_open (Linux only; and only if
+//   /proc/sys/kernel/perf_event_paranoid allows it, else they're reported as null)
+//   output: a table on stdout, and JSON with --json file
+
+// usage: notes_bench [--reps n] [--json file] [filter]
+// filter: run only the benchmarks whose name or claim contains it
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#if defined(_MSC_VER)
+#define NOTES_NOINLINE __declspec(noinline)
+#else
+#define NOTES_NOINLINE [[gnu::noinline]]
+#endif
+
+// keep the compiler from optimizing away a result or a computation
+template<typename T>
+inline void keep(T const& x)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(x) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &x;
+#endif
+}
+
+// cycles, instructions, and cache misses for this thread, as one group so they're counted over the same interval
+class Perf_counters {
+public:
+    static constexpr int n = 3;
+
+    Perf_counters()
+    {
+#if defined(__linux__)
+        const uint64_t events[n] = {PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i<n; ++i) {
+            perf_event_attr a {};
+            a.type = PERF_TYPE_HARDWARE;
+            a.size = sizeof(a);
+            a.config = events[i];
+            a.disabled = i==0; // the group leader starts disabled; the others follow it
+            a.exclude_kernel = 1;
+            a.exclude_hv = 1;
+            a.read_format = PERF_FORMAT_GROUP;
+            int fd = int(::syscall(__NR_perf_event_open,&a,0,-1,i==0 ? -1 : fds[0],0));
+            if (fd<0) { // not allowed, or no such counter (e.g., in a VM)
+                close_all();
+                return;
+            }
+            fds[i] = fd;
+        }
+#endif
+    }
+
+    Perf_counters(const Perf_counters&) = delete;
+    Perf_counters& operator=(const Perf_counters&) = delete;
+    ~Perf_counters() { close_all(); }
+
+    bool available() const { return fds[0]>=0; }
+
+    void start()
+    {
+#if defined(__linux__)
+        if (!available()) return;
+        ::ioctl(fds[0],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+        ::ioctl(fds[0],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    array<uint64_t,n> stop() // cycles, instructions, cache misses since start()
+    {
+        array<uint64_t,n> r {};
+#if defined(__linux__)
+        if (!available()) return r;
+        ::ioctl(fds[0],PERF_EVENT_IOC_DISABLE,PERF_IOC_FLAG_GROUP);
+        uint64_t buf[1+n] {}; // the number of counters, then the values
+        if (::read(fds[0],buf,sizeof(buf))==ssize_t(sizeof(buf)))
+            copy(buf+1,buf+1+n,r.begin());
+#endif
+        return r;
+    }
+private:
+    void close_all()
+    {
+#if defined(__linux__)
+        for (int& fd : fds)
+            if (fd>=0) ::close(exchange(fd,-1));
+#endif
+    }
+
+    int fds[n] = {-1,-1,-1};
+};
+
+struct Benchmark {
+    string claim; // the sentence from the notes it checks
+    string name;
+    size_t items; // per call of run, for the per-item numbers
+    function<void()> run;
+};
+
+struct Result {
+    const Benchmark* b;
+    vector<double> ns; // per item, one per repetition
+    optional<array<double,Perf_counters::n>> counters; // per item, over all repetitions
+
+    double min() const { return *min_element(ns.begin(),ns.end()); }
+    double max() const { return *max_element(ns.begin(),ns.end()); }
+    double mean() const { return accumulate(ns.begin(),ns.end(),0.0)/ns.size(); }
+    double median() const
+    {
+        auto v = ns;
+        nth_element(v.begin(),v.begin()+v.size()/2,v.end());
+        return v[v.size()/2];
+    }
+    double stddev() const
+    {
+        double m = mean(), sum = 0;
+        for (double x : ns) sum += (x-m)*(x-m);
+        return ns.size()>1 ? sqrt(sum/(ns.size()-1)) : 0;
+    }
+};
+
+Result measure(const Benchmark& b, int reps, Perf_counters& perf)
+{
+    using clock = chrono::steady_clock;
+    auto time_batches = [&](size_t k) {
+        auto t0 = clock::now();
+        for (size_t i = 0; i<k; ++i) b.run();
+        return chrono::duration<double,nano>(clock::now()-t0).count();
+    };
+
+    size_t batches = 1; // calibrate: double until a repetition takes 10ms
+    while (time_batches(batches)<1e7 && batches<(size_t(1)<<30))
+        batches *= 2;
+
+    for (int i = 0; i<3; ++i) // warmup
+        time_batches(batches);
+
+    Result r {&b,{},{}};
+    array<uint64_t,Perf_counters::n> total {};
+    for (int i = 0; i<reps; ++i) {
+        perf.start();
+        double ns = time_batches(batches);
+        auto c = perf.stop();
+        for (int j = 0; j<Perf_counters::n; ++j) total[j] += c[j];
+        r.ns.push_back(ns/(batches*b.items));
+    }
+    if (perf.available()) {
+        array<double,Perf_counters::n> per_item;
+        for (int j = 0; j<Perf_counters::n; ++j)
+            per_item[j] = double(total[j])/(double(reps)*batches*b.items);
+        r.counters = per_item;
+    }
+    return r;
+}
+
+void print_table(const vector<Result>& results)
+{
+    string claim;
+    for (const Result& r : results) {
+        if (r.b->claim!=claim) {
+            claim = r.b->claim;
+            cout << '\n' << '"' << claim << "\"\n";
+        }
+        cout << "  " << left << setw(28) << r.b->name << right << fixed << setprecision(3)
+             << setw(10) << r.median() << " ns/item (min " << r.min() << ", sd " << r.stddev() << ")";
+        if (r.counters) {
+            auto& c = *r.counters;
+            cout << setprecision(2) << "  " << c[0] << " cycles, " << c[1] << " instr, " << c[2] << " misses";
+        }
+        cout << '\n';
+    }
+}
+
+void write_json(ostream& os, const vector<Result>& results)
+{
+    auto quoted = [](const string& s) {
+        string r = "\"";
+        for (char c : s) {
+            if (c=='"' || c=='\\') r += '\\';
+            r += c;
+        }
+        return r+'"';
+    };
+    os << "{\n  \"benchmarks\": [";
+    const char* sep = "\n";
+    for (const Result& r : results) {
+        os << sep << "    {\"claim\": " << quoted(r.b->claim) << ", \"name\": " << quoted(r.b->name)
+           << ", \"reps\": " << r.ns.size()
+           << ", \"ns_per_item\": {\"min\": " << r.min() << ", \"median\": " << r.median() << ", \"mean\": " << r.mean()
+           << ", \"stddev\": " << r.stddev() << ", \"max\": " << r.max() << "}";
+        const char* names[] = {"cycles_per_item","instructions_per_item","cache_misses_per_item"};
+        for (int j = 0; j<Perf_counters::n; ++j) {
+            os << ", \"" << names[j] << "\": ";
+            if (r.counters) os << (*r.counters)[j];
+            else os << "null";
+        }
+        os << '}';
+        sep = ",\n";
+    }
+    os << "\n  ]\n}\n";
+}
+
+// the benchmarks, one group per claim
+
+struct X {
+    int i;
+};
+
+void unique_ptr_benchmarks(vector<Benchmark>& bs)
+{
+    const string claim = "unique_ptr is lightweight and has no overhead in terms of space or time";
+    constexpr size_t n = 1000;
+
+    bs.push_back({claim,"new/delete, X*",n,[] {
+        for (size_t i = 0; i<n; ++i) {
+            X* p = new X{int(i)};
+            keep(p->i);
+            delete p;
+        }
+    }});
+    bs.push_back({claim,"make_unique, unique_ptr<X>",n,[] {
+        for (size_t i = 0; i<n; ++i) {
+            auto p = make_unique<X>(int(i));
+            keep(p->i);
+        }
+    }});
+
+    // use through the pointer: the same loads either way
+    auto raw = make_shared<vector<X*>>();
+    auto owned = make_shared<vector<unique_ptr<X>>>();
+    for (size_t i = 0; i<n; ++i) {
+        owned->push_back(make_unique<X>(int(i)));
+        raw->push_back(owned->back().get());
+    }
+    bs.push_back({claim,"deref, X*",n,[raw] {
+        long long s = 0;
+        for (X* p : *raw) s += p->i;
+        keep(s);
+    }});
+    bs.push_back({claim,"deref, unique_ptr<X>",n,[owned] {
+        long long s = 0;
+        for (const auto& p : *owned) s += p->i;
+        keep(s);
+    }});
+}
+
+struct S {
+    int i;
+    string s;
+    double d;
+};
+
+void make_shared_benchmarks(vector<Benchmark>& bs)
+{
+    const string claim = "make_shared is notably more efficient because it does not need a separate allocation for the use count";
+    constexpr size_t n = 1000;
+
+    bs.push_back({claim,"shared_ptr<S>{new S}",n,[] {
+        vector<shared_ptr<S>> v;
+        v.reserve(n);
+        for (size_t i = 0; i<n; ++i)
+            v.push_back(shared_ptr<S>{new S{int(i),"Oz",7.62}});
+        keep(v.back()->i);
+    }});
+    bs.push_back({claim,"make_shared<S>",n,[] {
+        vector<shared_ptr<S>> v;
+        v.reserve(n);
+        for (size_t i = 0; i<n; ++i)
+            v.push_back(make_shared<S>(int(i),"Oz",7.62));
+        keep(v.back()->i);
+    }});
+}
+
+// out of line, so that the array is passed rather than folded into the caller
+template<size_t N>
+NOTES_NOINLINE long long sum_builtin(const int (&a)[N])
+{
+    long long s = 0;
+    for (int x : a) s += x;
+    return s;
+}
+
+template<size_t N>
+NOTES_NOINLINE long long sum_std(const array<int,N>& a)
+{
+    long long s = 0;
+    for (int x : a) s += x;
+    return s;
+}
+
+void array_benchmarks(vector<Benchmark>& bs)
+{
+    const string claim = "there is no space or time overhead when using an array compared to using a built-in array";
+    constexpr size_t n = 1024;
+
+    bs.push_back({claim,"int[1024]: fill, sum",n,[] {
+        int a[n];
+        for (size_t i = 0; i<n; ++i) a[i] = int(i);
+        keep(&a[0]); // both arrays escape the same way: as a pointer to their first element
+        keep(sum_builtin(a));
+    }});
+    bs.push_back({claim,"array<int,1024>: fill, sum",n,[] {
+        array<int,n> a;
+        for (size_t i = 0; i<n; ++i) a[i] = int(i);
+        keep(a.data());
+        keep(sum_std(a));
+    }});
+}
+
+struct Expr { int v; };
+struct Stmt { int v; };
+struct Decl { int v; };
+struct Typ { int v; };
+using Node = variant<Expr,Stmt,Decl,Typ>;
+
+struct Base { virtual ~Base() = default; virtual int eval() const = 0; };
+struct Expr_node : Base { int v; explicit Expr_node(int v) : v{v} {} int eval() const override { return v+1; } };
+struct Stmt_node : Base { int v; explicit Stmt_node(int v) : v{v} {} int eval() const override { return v*2; } };
+struct Decl_node : Base { int v; explicit Decl_node(int v) : v{v} {} int eval() const override { return v-3; } };
+struct Typ_node : Base { int v; explicit Typ_node(int v) : v{v} {} int eval() const override { return v^5; } };
+
+template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
+
+void visit_benchmarks(vector<Benchmark>& bs)
+{
+    const string claim = "visit is equivalent to a virtual function call, but potentially faster (and tidier than holds_alternative)";
+    constexpr size_t n = 10'000;
+
+    auto nodes = make_shared<vector<Node>>();
+    auto objs = make_shared<vector<unique_ptr<Base>>>();
+    mt19937 gen;
+    for (size_t i = 0; i<n; ++i) {
+        int v = int(gen()%1000);
+        switch (gen()%4) { // a random mix, so the branch predictor can't learn the order
+        case 0: nodes->emplace_back(Expr{v}); objs->push_back(make_unique<Expr_node>(v)); break;
+        case 1: nodes->emplace_back(Stmt{v}); objs->push_back(make_unique<Stmt_node>(v)); break;
+        case 2: nodes->emplace_back(Decl{v}); objs->push_back(make_unique<Decl_node>(v)); break;
+        default: nodes->emplace_back(Typ{v}); objs->push_back(make_unique<Typ_node>(v)); break;
+        }
+    }
+    static const auto eval = overloaded {
+        [](const Expr& e) { return e.v+1; },
+        [](const Stmt& s) { return s.v*2; },
+        [](const Decl& d) { return d.v-3; },
+        [](const Typ& t) { return t.v^5; },
+    };
+
+    bs.push_back({claim,"holds_alternative chain",n,[nodes] {
+        long long s = 0;
+        for (const Node& x : *nodes) {
+            if (holds_alternative<Expr>(x)) s += eval(get<Expr>(x));
+            else if (holds_alternative<Stmt>(x)) s += eval(get<Stmt>(x));
+            else if (holds_alternative<Decl>(x)) s += eval(get<Decl>(x));
+            else s += eval(get<Typ>(x));
+        }
+        keep(s);
+    }});
+    bs.push_back({claim,"visit",n,[nodes] {
+        long long s = 0;
+        for (const Node& x : *nodes) s += visit(eval,x);
+        keep(s);
+    }});
+    bs.push_back({claim,"virtual function",n,[objs] {
+        long long s = 0;
+        for (const auto& p : *objs) s += p->eval();
+        keep(s);
+    }});
+}
+
+int main(int argc, char* argv[])
+{
+    int reps = 15;
+    string json_file;
+    string filter;
+    for (int i = 1; i<argc; ++i) {
+        string arg = argv[i];
+        if (arg=="--reps" && i+1<argc) reps = max(1,stoi(argv[++i]));
+        else if (arg=="--json" && i+1<argc) json_file = argv[++i];
+        else if (arg.starts_with("--")) {
+            cerr << "usage: " << argv[0] << " [--reps n] [--json file] [filter]\n";
+            return 1;
+        }
+        else filter = arg;
+    }
+
+    vector<Benchmark> bs;
+    unique_ptr_benchmarks(bs);
+    make_shared_benchmarks(bs);
+    array_benchmarks(bs);
+    visit_benchmarks(bs);
+
+    Perf_counters perf;
+    if (!perf.available())
+        cerr << "hardware counters not available (see /proc/sys/kernel/perf_event_paranoid); timing only\n";
+
+    vector<Result> results;
+    for (const Benchmark& b : bs)
+        if (b.name.find(filter)!=string::npos || b.claim.find(filter)!=string::npos)
+            results.push_back(measure(b,reps,perf));
+
+    print_table(results);
+    if (!json_file.empty()) {
+        ofstream os {json_file};
+        write_json(os,results);
+        if (!os) {
+            cerr << "can't write " << json_file << '\n';
+            return 1;
+        }
+    }
+}
@@ -58,6 +58,170 @@ void f()
 // this is an example of RAII
 // RAII is fundamental to handling of resources in C++
 
+// when every thread goes through the same mutex, that mutex becomes a convoy point
+// threads queue up behind each other even when they touch unrelated parts of the shared data
+
+// two ways out:
+// split the data and give each part its own mutex (striping or sharding)
+// let readers skip the lock entirely and retry if a writer got in the way (seqlock)
+
+// all three versions below offer the same read()/write() interface, so we can pick one without changing the callers
+
+template<typename T>
+class Locked { // the scoped_lock version: one mutex for all of the data
+public:
+    template<typename F>
+    auto write(F f) { scoped_lock lck {m}; return f(data); }
+
+    template<typename F>
+    auto read(F f) const { scoped_lock lck {m}; return f(data); }
+private:
+    mutable mutex m;
+    T data {};
+};
+
+template<typename T, size_t N = 16>
+class Sharded { // N Locked<T>s, the key picks the shard
+public:
+    template<typename F>
+    auto write(size_t key, F f) { return shards[key%N].state.write(f); }
+
+    template<typename F>
+    auto read(size_t key, F f) const { return shards[key%N].state.read(f); }
+
+    template<typename F>
+    void for_each(F f) const // visits every shard, one lock at a time
+    {
+        for (auto& s : shards)
+            s.state.read(f);
+    }
+private:
+    struct alignas(64) Shard { // keep each mutex on its own cache line (64 bytes on most machines)
+        Locked<T> state;
+    };
+    array<Shard,N> shards;
+};
+
+// a seqlock keeps a sequence number next to the data
+// the writer makes the number odd while it writes and even when it's done
+// a reader copies the data and retries if the number was odd or changed while it copied
+// readers never write to shared memory, so they don't bounce cache lines between cores
+
+// only works for trivially copyable data because a reader might copy a half-written value before it retries
+
+template<typename T>
+    requires is_trivially_copyable_v<T>
+class Seqlocked {
+public:
+    template<typename F>
+    void write(F f)
+    {
+        scoped_lock lck {m}; // writers still exclude each other
+        T tmp = load();
+        f(tmp);
+        seq.fetch_add(1,memory_order_relaxed); // odd: write in progress
+        atomic_thread_fence(memory_order_release);
+        store(tmp);
+        seq.fetch_add(1,memory_order_release); // even: done
+    }
+
+    T read() const // lock free
+    {
+        for (;;) {
+            unsigned s1 = seq.load(memory_order_acquire);
+            if (s1&1) continue; // a writer is busy
+            T res = load();
+            atomic_thread_fence(memory_order_acquire);
+            if (seq.load(memory_order_relaxed)==s1)
+                return res;
+        }
+    }
+
+    template<typename F>
+    auto read(F f) const { return f(read()); }
+private:
+    // the data is kept as relaxed atomic words so a racing read isn't a data race
+    static constexpr size_t words = (sizeof(T)+sizeof(unsigned long)-1)/sizeof(unsigned long);
+
+    T load() const
+    {
+        array<unsigned long,words> buf;
+        for (size_t i = 0; i<words; ++i)
+            buf[i] = data[i].load(memory_order_relaxed);
+        array<byte,sizeof(T)> raw; // bit_cast makes the T, so T needn't be default constructible
+        memcpy(raw.data(),buf.data(),sizeof(T));
+        return bit_cast<T>(raw);
+    }
+
+    void store(const T& x)
+    {
+        array<unsigned long,words> buf {};
+        memcpy(buf.data(),&x,sizeof(T));
+        for (size_t i = 0; i<words; ++i)
+            data[i].store(buf[i],memory_order_relaxed);
+    }
+
+    mutex m;
+    atomic<unsigned> seq {0};
+    array<atomic<unsigned long>,words> data {};
+};
+
+// picking a scheme is now a type choice
+
+enum class Lock_mode { single, sharded, seqlock };
+
+template<typename T, Lock_mode M>
+using Shared_state = conditional_t<M==Lock_mode::single, Locked<T>,
+                     conditional_t<M==Lock_mode::sharded, Sharded<T>, Seqlocked<T>>>;
+
+// contention benchmark: n threads, each doing ops reads and writes, for n = 1 to the number of cores
+// prints throughput per core; with a single mutex it drops as n grows, with the others it should stay flat
+
+struct Counters {
+    long hits;
+    long misses;
+};
+
+template<Lock_mode M>
+void bench_contention(int ops = 1'000'000, int reads_per_write = 8)
+{
+    const int max_threads = max(1u,thread::hardware_concurrency());
+    for (int n = 1; n<=max_threads; ++n) {
+        Shared_state<Counters,M> state;
+        auto t0 = chrono::steady_clock::now();
+        {
+            vector<jthread> threads;
+            for (int t = 0; t<n; ++t)
+                threads.emplace_back([&state,t,ops,reads_per_write] {
+                    long sum = 0;
+                    for (int i = 0; i<ops; ++i) {
+                        auto bump = [](Counters& c) { ++c.hits; };
+                        auto peek = [](const Counters& c) { return c.hits; };
+                        if (i%(reads_per_write+1)==0) {
+                            if constexpr (M==Lock_mode::sharded) state.write(t+i,bump);
+                            else state.write(bump);
+                        }
+                        else {
+                            if constexpr (M==Lock_mode::sharded) sum += state.read(t+i,peek);
+                            else sum += state.read(peek);
+                        }
+                    }
+                    volatile long sink = sum; // keep the reads
+                    (void)sink;
+                });
+        } // jthreads join here
+        chrono::duration<double> d = chrono::steady_clock::now()-t0;
+        cout << n << " threads: " << ops/d.count()/1e6 << " Mops/s per core\n";
+    }
+}
+
+void bench_contention_all()
+{
+    cout << "scoped_lock:\n"; bench_contention<Lock_mode::single>();
+    cout << "sharded:\n"; bench_contention<Lock_mode::sharded>();
+    cout << "seqlock:\n"; bench_contention<Lock_mode::seqlock>();
+}
+
 // The memory library provides two objects to help manage objects on the free store
 
 // unique_ptr represents unique ownership (it's destructor destroys the object)
@@ -132,331 +296,3733 @@ void user(const string& name, ios_base::openmode mode)
 // this isn't really expensive, but it makes the lifetime of a shared object tough to predicts
 // think if you actually need shared owneship before calling on shared_ptr
 
-// creating an object on the free store, assinging it to a ptr, and then passing the ptr to a smart ptr is verbose
-// it allows for mistakes, like forgetting to pass the ptr to a unique_ptr or giving the ptr to something that isn't on the free store to shared_ptr
+// every copy of a shared_ptr does an atomic increment, and every destruction an atomic decrement
+// user() pays that for each call of f(fp) and g(fp) even though the file never leaves the thread
 
-// to avoid these problems, the std provides functions for constructing an object and then returning an appropriate smart ptr
-// these are make_shared and make_unique functions
+// first fix: don't copy the handle at all
+// a function that just uses the file doesn't take part in its ownership, so it can borrow a reference
 
-struct S {
-    int i;
-    string s;
-    double d;
-    // ..
+void f(fstream&);
+void g(fstream&);
+
+// when we really need shared ownership on one thread, the count doesn't need to be atomic
+// a handle with the counting policy as a template argument:
+
+struct Atomic_count { // safe to share across threads, like shared_ptr
+    atomic<long> n {1};
+    void inc() { n.fetch_add(1,memory_order_relaxed); }
+    bool dec() { return n.fetch_sub(1,memory_order_acq_rel)==1; } // true when the last owner is gone
+    long get() const { return n.load(memory_order_relaxed); }
 };
 
-auto p1 = make_shared<S>(1,"Ankh Morpork", 4.65); // p1 is a shared_ptr<S>
-auto p2 = make_unique<S>(2, "Oz",7.62); // p2 is a unique_ptr<S>
+struct Local_count { // a plain integer: the handle and all its copies must stay on one thread
+    long n {1};
+    void inc() { ++n; }
+    bool dec() { return --n==0; }
+    long get() const { return n; }
+};
 
-// p2 is a unique_tr<S> pointing to a free-store allocated object of type S with the value {2, "Oz",7.62}.
+// Shared keeps the count and the object in one allocation, like make_shared does
+template<typename T, typename Count = Local_count>
+class Shared {
+public:
+    template<typename... Args>
+    static Shared make(Args&&... args) { return Shared{new Block{{},T(forward<Args>(args)...)}}; }
+
+    Shared(const Shared& s) : b{s.b} { if (b) b->count.inc(); }
+    Shared(Shared&& s) noexcept : b{exchange(s.b,nullptr)} {}
+    Shared& operator=(Shared s) noexcept { swap(b,s.b); return *this; } // copy-and-swap
+    ~Shared() { if (b && b->count.dec()) delete b; }
+
+    T& operator*() const { return b->obj; }
+    T* operator->() const { return &b->obj; }
+    explicit operator bool() const { return b; }
+    long use_count() const { return b ? b->count.get() : 0; }
+private:
+    struct Block {
+        Count count;
+        T obj;
+    };
+    explicit Shared(Block* p) : b{p} {}
+    Block* b = nullptr;
+};
 
-// using make_shared() is not just more convenient than seperatly making an object using new and then passing
-// it to shared_ptr - it is also notable more efficient because it does not need a seperate allocation for the 
-// use count that is essential in the implementation of shared_ptr
+// the intrusive version: the object carries its own count, so the handle is a single pointer
+// and we can make a new handle from a plain T* (e.g., this) without losing track of the count
 
-// with unique_ptr and shared_ptr, we can implement a "no naked new" policy for many programs
+template<typename Count = Local_count>
+struct Counted {
+    Count count;
+};
 
-// but, favor containers that manager their own resources of unique_ptr and shared_ptr
-// they're still conceptually ptrs
+template<typename T> // T must derive from some Counted<Count>
+class Intrusive_ptr {
+public:
+    explicit Intrusive_ptr(T* p = nullptr) : p{p} {} // takes over the initial count of 1
+    Intrusive_ptr(const Intrusive_ptr& x) : p{x.p} { if (p) p->count.inc(); }
+    Intrusive_ptr(Intrusive_ptr&& x) noexcept : p{exchange(x.p,nullptr)} {}
+    Intrusive_ptr& operator=(Intrusive_ptr x) noexcept { swap(p,x.p); return *this; }
+    ~Intrusive_ptr() { if (p && p->count.dec()) delete p; }
+
+    T& operator*() const { return *p; }
+    T* operator->() const { return p; }
+    explicit operator bool() const { return p; }
+private:
+    T* p;
+};
 
-// shared_prs don't provide rules to control access to the shared object
-// data races and other forms of confusions still exists when using shared_ptrs
+struct Counted_fstream : fstream, Counted<Local_count> {
+    using fstream::fstream;
+};
 
-// use unique_ptr rather than resource handles when we need ptr semantics
+// user() again: one owner, and f() and g() borrow the stream
 
-// when we shared an object, we need ptrs or references to refer to the object. shared_ptr is the obvious choice here
-// when we refer to a polymorpgic object in classical object-oriented code, we need a pointer or ref because know the exact type of the object referred to or its size. use unique_ptr
-// shared polymorphic objects usually require shared_ptrs
+void user2(const string& name, ios_base::openmode mode)
+{
+    auto fp = Shared<fstream>::make(name,mode); // non-atomic count, one allocation
+    if (!*fp) // make sure the file was properly opened
+        throw No_file{};
 
-// we don't need to use a pointer to return a collection of objects from a function. 
-// a container will do that simply and efficiently with copy elison and move semantics
+    f(*fp);
+    g(*fp);
+    // .. copies of fp can be stored, as long as they stay on this thread ..
+}
 
-// 15.2.2 span
-// range errors cause a lot of problems in C and C++
-// containers, algos, and range-for can reduce these problems
-// big soure of range errors: passing ptrs (raw or smart) and then relying on convention to know the number of elements pointed to
+// microbenchmark: the cost of one copy plus one destruction of a handle under each policy
+template<typename Handle>
+double ns_per_copy(const Handle& h, int n = 10'000'000)
+{
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i<n; ++i) {
+        Handle copy = h;
+        asm volatile("" : : "r"(&copy) : "memory"); // gcc/clang: don't optimize the copy away
+    }
+    chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+    return d.count()/n;
+}
 
-// best advice for code outside resource handles is to assume that at most one object is pointed to but without support that advice is unmanageable
-// string_view can help, but it's read-only and just for characters
+void bench_handle_copy()
+{
+    cout << "shared_ptr:      " << ns_per_copy(make_shared<fstream>()) << " ns\n";
+    cout << "Shared<atomic>:  " << ns_per_copy(Shared<fstream,Atomic_count>::make()) << " ns\n";
+    cout << "Shared<local>:   " << ns_per_copy(Shared<fstream,Local_count>::make()) << " ns\n";
+    cout << "Intrusive_ptr:   " << ns_per_copy(Intrusive_ptr<Counted_fstream>{new Counted_fstream}) << " ns\n";
+    // passing by reference costs nothing at all, which is the point of borrowing
+    // note: libstdc++'s shared_ptr skips the atomics when the program never starts a thread, so measure with threads running
+}
 
-// when writing into and reading out of buggers in lower-level software, it's difficult to maintain high performance
-// while still avoiding range errors ("buffer overruns")
+// reading through an fstream copies every byte from the kernel into the stream's buffer and then into ours
+// for a file we just scan, we can map it into memory instead and look at the bytes where they are
 
-// a span is a (pointer,length) pair denoting a sequence of elements
+// Mapped_file is a resource handle like fstream: the constructor acquires, the destructor releases
+// it throws No_file on failure, like user() does, so callers don't need an extra check
+// uses POSIX mmap (<sys/mman.h>, <fcntl.h>, <unistd.h>, <sys/stat.h>); Windows would need CreateFileMapping
 
-// span gives access to contiguous sequences of elements
+class Mapped_file {
+public:
+    // window==0: map the whole file
+    // window>0: map at most window bytes at a time and move through the file with next()
+    //           that's for files bigger than the address space or RAM we want to spend
+    explicit Mapped_file(const string& name, size_t window = 0)
+        : fd{::open(name.c_str(),O_RDONLY)}
+    {
+        struct stat st;
+        if (fd<0 || ::fstat(fd,&st)<0) {
+            if (fd>=0) ::close(fd);
+            throw No_file{};
+        }
+        file_size = st.st_size;
+        const size_t page = ::sysconf(_SC_PAGESIZE);
+        win = window==0 ? file_size : (window+page-1)/page*page; // window offsets must be page aligned
+        try {
+            map(0);
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
 
-// these elements can be stored in many ways, including vectors and built in arrays
+    Mapped_file(const Mapped_file&) = delete;
+    Mapped_file& operator=(const Mapped_file&) = delete;
 
-// like ptrs, span's don't own the characters they point to
+    ~Mapped_file()
+    {
+        unmap();
+        ::close(fd);
+    }
 
-// it is thus similar to string_view
+    span<const byte> bytes() const { return {static_cast<const byte*>(base),len}; } // the current window
+    string_view text() const { return {static_cast<const char*>(base),len}; }
+    size_t offset() const { return off; } // of the current window in the file
+    size_t size() const { return file_size; } // of the whole file
 
-// a common interface style
-void fpn(int* p, int n)
+    bool next() // move to the next window; false at the end of the file
+    {
+        if (off+len>=file_size)
+            return false;
+        map(off+len);
+        return true;
+    }
+private:
+    void map(size_t pos)
+    {
+        unmap();
+        off = pos;
+        len = min(win,file_size-pos);
+        if (len==0) // mmap of zero bytes fails, but an empty file is not an error
+            return;
+        base = ::mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,off);
+        if (base==MAP_FAILED) {
+            base = nullptr;
+            len = 0;
+            throw No_file{};
+        }
+        ::madvise(base,len,MADV_SEQUENTIAL); // a hint for read-ahead
+    }
+
+    void unmap()
+    {
+        if (base)
+            ::munmap(base,len);
+        base = nullptr;
+    }
+
+    int fd;
+    size_t file_size = 0;
+    size_t win = 0;
+    size_t off = 0;
+    size_t len = 0;
+    void* base = nullptr;
+};
+
+void f(span<const byte>);
+
+void user3(const string& name)
 {
-    for (int i = 0; i<n; ++i)
-        p[i] = 0;
+    Mapped_file mf {name}; // throws No_file if the file can't be opened
+    f(mf.bytes()); // no copy: f() looks straight at the mapped pages
+    // ..
 }
 
-// we can assume that *p points to n integers
-// this assumption is just a convetion, so can't use it to write a range-for loop and the compiler can't implement cheap and efficient range checking
-// this assumption can also be wrong
+// benchmark: a sequential scan (sum of all bytes) with fstream::read into a buffer and with Mapped_file
 
-void use(int x)
+unsigned long scan_fstream(const string& name)
 {
-    int a[100]; // Ok
-    fpn (a,1000); // woops, my finger slipped
-    fpn (a+10,100); // range error in fpn;
-    fpn(a,x); // suspect, but looks innocent
+    ifstream in {name,ios::binary};
+    vector<char> buf(1<<16);
+    unsigned long sum = 0;
+    while (in.read(buf.data(),buf.size()) || in.gcount())
+        for (char c : span{buf.data(),size_t(in.gcount())})
+            sum += static_cast<unsigned char>(c);
+    return sum;
 }
 
-// span can prevent these kinds of errors
-void fs(span<int> p)
+unsigned long scan_mapped(const string& name, size_t window = 0)
 {
-    for (int& x : p)
-        x = 0;
+    Mapped_file mf {name,window};
+    unsigned long sum = 0;
+    do {
+        for (byte b : mf.bytes())
+            sum += to_integer<unsigned char>(b);
+    } while (mf.next());
+    return sum;
 }
 
-void use(int x)
+void bench_scan(size_t file_size = 256<<20)
 {
-    int a[100];
-    fs(a); // implicitly creates a span<int>{a,100}
-    fs(a,1000); // error: span expected
-    fs({a+10,100}); // a range error in fs
-    fs({a,x}); // obviously suspect
+    auto name = (filesystem::temp_directory_path()/"notes_scan.bin").string();
+    {
+        ofstream out {name,ios::binary};
+        vector<char> block(1<<20);
+        iota(block.begin(),block.end(),0);
+        for (size_t n = 0; n<file_size; n += block.size())
+            out.write(block.data(),block.size());
+    }
+
+    auto time = [&](const char* label, auto scan) {
+        auto t0 = chrono::steady_clock::now();
+        auto sum = scan();
+        chrono::duration<double> d = chrono::steady_clock::now()-t0;
+        cout << label << file_size/d.count()/(1<<20) << " MB/s (sum " << sum << ")\n";
+    };
+    time("fstream:        ",[&] { return scan_fstream(name); });
+    time("mapped:         ",[&] { return scan_mapped(name); });
+    time("mapped, 16MB:   ",[&] { return scan_mapped(name,16<<20); });
+
+    filesystem::remove(name);
 }
 
-// the common case of creating a span from an array is now safe and notationally simple
-// explicitly composiing a span makes error-detection easier. 
+// in user(), f(fp) and g(fp) run one after the other, and each waits for the disk whenever it reads
+// with many files, most of the time is spent waiting, one read at a time
+// we'd rather keep several reads in flight, and let g work on one chunk while f's next reads are on their way
+
+// namespace aio is a small coroutine-based file API:
+//   Loop: runs coroutines (Task) on one thread; a coroutine that waits for a read or a Channel is suspended, not blocked
+//   the reads go to a backend: io_uring where the kernel allows it (Linux 5.6 or later, and not blocked by a seccomp policy),
+//   otherwise a pool of threads doing pread() (epoll is no help here: regular files are always "ready")
+//   Channel<T>: a bounded queue between coroutines; a full Channel suspends the producer, an empty one the consumer
+//   Async_file: the file handle; shared_ptr<Async_file> plays fp's role, so the file is closed when the last stage is done
+
+// the io_uring backend talks to the kernel directly (<linux/io_uring.h>, <sys/syscall.h>, <sys/mman.h>);
+// liburing would hide the ring handling, but it's one more library to install
+
+namespace aio {
+
+struct Io_request {
+    int fd;
+    byte* buf;
+    size_t len;
+    off_t off;
+    ssize_t result = 0; // bytes read, or -errno
+    bool done = false;
+    coroutine_handle<> waiter; // resumed when done; none if nobody is waiting yet
+};
 
-// common case where a span is passed along from function to function is simpler than (poiner,count) interfaces and doesn't require extra checking
+class Backend {
+public:
+    virtual ~Backend() = default;
+    virtual void submit(Io_request* r) = 0;
+    virtual void wait(vector<Io_request*>& done) = 0; // wait for at least one submitted request to complete
+    virtual const char* name() const = 0;
+};
 
-void f1(span<int> p);
+class Uring_backend : public Backend {
+public:
+    explicit Uring_backend(unsigned entries = 256)
+    {
+        io_uring_params p {};
+        ring_fd = int(::syscall(__NR_io_uring_setup,entries,&p));
+        if (ring_fd<0)
+            throw system_error{errno,system_category(),"io_uring_setup"};
+        sq_entries = p.sq_entries;
+
+        sq_len = p.sq_off.array+p.sq_entries*sizeof(unsigned);
+        cq_len = p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+        if (p.features&IORING_FEAT_SINGLE_MMAP) // one mapping for both rings
+            sq_len = cq_len = max(sq_len,cq_len);
+        try {
+            sq_ring = map(sq_len,IORING_OFF_SQ_RING);
+            cq_ring = (p.features&IORING_FEAT_SINGLE_MMAP) ? sq_ring : map(cq_len,IORING_OFF_CQ_RING);
+            sqes = static_cast<io_uring_sqe*>(map(p.sq_entries*sizeof(io_uring_sqe),IORING_OFF_SQES));
+        }
+        catch (...) { // unmap what was mapped before the failure
+            release();
+            throw;
+        }
+
+        auto at = [](void* ring, unsigned off) { return reinterpret_cast<unsigned*>(static_cast<char*>(ring)+off); };
+        sq_head = at(sq_ring,p.sq_off.head);
+        sq_tail = at(sq_ring,p.sq_off.tail);
+        sq_mask = *at(sq_ring,p.sq_off.ring_mask);
+        sq_array = at(sq_ring,p.sq_off.array);
+        cq_head = at(cq_ring,p.cq_off.head);
+        cq_tail = at(cq_ring,p.cq_off.tail);
+        cq_mask = *at(cq_ring,p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq_ring)+p.cq_off.cqes);
+    }
 
-void fs(span<int> p)
-{
-    // ..
-    f1(p);
-}
+    Uring_backend(const Uring_backend&) = delete;
+    Uring_backend& operator=(const Uring_backend&) = delete;
 
-// when span is used for subscripting, range checking isn't done and out-of-range access is undefined behaivor
-// an implementation to implement range checking when subscripting, but few do
-// the original gsl::span from the Core Guidelines support lib does range checking
+    ~Uring_backend() { release(); }
 
-//15.3 Containers
-// std provides contaienrs that don't fit perfectly in the STL framework
-// examples: built in arrays, array, string
+    void submit(Io_request* r) override
+    {
+        unsigned tail = *sq_tail; // only we write the tail
+        if (tail-atomic_ref{*sq_head}.load(memory_order_acquire)==sq_entries) { // full: let the kernel take what we have
+            unsubmitted -= enter(unsubmitted,0);
+            tail = *sq_tail;
+        }
+        unsigned i = tail&sq_mask;
+        io_uring_sqe& e = sqes[i];
+        e = {};
+        e.opcode = IORING_OP_READ;
+        e.fd = r->fd;
+        e.addr = reinterpret_cast<uintptr_t>(r->buf);
+        e.len = unsigned(r->len);
+        e.off = r->off;
+        e.user_data = reinterpret_cast<uintptr_t>(r);
+        sq_array[i] = i;
+        atomic_ref{*sq_tail}.store(tail+1,memory_order_release); // the kernel may look at the entry from now on
+        ++unsubmitted;
+    }
 
-// 15.3.1 array
-// array is a fixed-size sequence of elements where the number of elements is specified at compile time
+    void wait(vector<Io_request*>& done) override
+    {
+        unsubmitted -= enter(unsubmitted,1); // submit everything, wait for a completion
+        unsigned head = *cq_head;
+        unsigned tail = atomic_ref{*cq_tail}.load(memory_order_acquire);
+        for (; head!=tail; ++head) {
+            const io_uring_cqe& c = cqes[head&cq_mask];
+            auto r = reinterpret_cast<Io_request*>(c.user_data);
+            r->result = c.res;
+            done.push_back(r);
+        }
+        atomic_ref{*cq_head}.store(head,memory_order_release); // the kernel may reuse the entries
+    }
 
-// an array can thus be allocated with its elements on the stack, in an object, or in static storage
-// these elements are allocated in the scope where array is defined
+    const char* name() const override { return "io_uring"; }
+private:
+    void* map(size_t len, off_t what)
+    {
+        void* p = ::mmap(nullptr,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring_fd,what);
+        if (p==MAP_FAILED)
+            throw system_error{errno,system_category(),"io_uring mmap"};
+        return p;
+    }
 
-// array is first understood as a built-in array with its size firmly attached, without implicit conversions to ptr types, with few qol functions
+    void release() // whatever has been mapped, and the ring
+    {
+        if (sqes) ::munmap(sqes,sq_entries*sizeof(io_uring_sqe));
+        if (cq_ring && cq_ring!=sq_ring) ::munmap(cq_ring,cq_len);
+        if (sq_ring) ::munmap(sq_ring,sq_len);
+        ::close(ring_fd);
+    }
 
-// there is no space or time overhead when using an array compared to using a built-in array
+    // the number of entries the kernel took; on an error it took none, so they're still counted in unsubmitted
+    unsigned enter(unsigned to_submit, unsigned min_complete)
+    {
+        long n;
+        while ((n = ::syscall(__NR_io_uring_enter,ring_fd,to_submit,min_complete,min_complete ? IORING_ENTER_GETEVENTS : 0,nullptr,0))<0)
+            if (errno!=EINTR)
+                throw system_error{errno,system_category(),"io_uring_enter"};
+        return unsigned(n);
+    }
 
-// array doesn't follow the "handle to elements" model of Stl containers
+    int ring_fd;
+    unsigned sq_entries;
+    size_t sq_len, cq_len;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+    unsigned unsubmitted = 0;
+};
 
-// array directly contains its elements
+class Pool_backend : public Backend {
+public:
+    explicit Pool_backend(unsigned threads = max(4u,thread::hardware_concurrency()))
+    {
+        for (unsigned i = 0; i<threads; ++i)
+            workers.emplace_back([this](stop_token st) { work(st); });
+    }
 
-// it's just a safer version of a built-in array
+    ~Pool_backend()
+    {
+        for (auto& w : workers) w.request_stop();
+        todo_cv.notify_all();
+    } // the jthreads join
 
-// this implies that an array can and must be initialized by an initializer list
+    void submit(Io_request* r) override
+    {
+        {
+            scoped_lock lck {todo_m};
+            todo.push_back(r);
+        }
+        todo_cv.notify_one();
+    }
 
-std::array<int,3> a1 = {1,2,3};
-// number of elements in the initializer must be equal to or less than the number of elements specified for the array
+    void wait(vector<Io_request*>& done) override
+    {
+        unique_lock lck {done_m};
+        done_cv.wait(lck,[this] { return !finished.empty(); });
+        done.insert(done.end(),finished.begin(),finished.end());
+        finished.clear();
+    }
 
-// the element count is required and we need to state the type of the elements
+    const char* name() const override { return "thread pool"; }
+private:
+    void work(stop_token st)
+    {
+        for (;;) {
+            Io_request* r;
+            {
+                unique_lock lck {todo_m};
+                if (!todo_cv.wait(lck,st,[this] { return !todo.empty(); }))
+                    return; // stop requested
+                r = todo.front();
+                todo.pop_front();
+            }
+            ssize_t n;
+            while ((n = ::pread(r->fd,r->buf,r->len,r->off))<0 && errno==EINTR)
+                ;
+            r->result = n<0 ? -errno : n;
+            {
+                scoped_lock lck {done_m};
+                finished.push_back(r);
+            }
+            done_cv.notify_one();
+        }
+    }
 
-void f(int n)
+    mutex todo_m;
+    condition_variable_any todo_cv;
+    deque<Io_request*> todo;
+    mutex done_m;
+    condition_variable done_cv;
+    vector<Io_request*> finished;
+    vector<jthread> workers; // last: destroyed (joined) first
+};
+
+inline unique_ptr<Backend> make_backend()
 {
-    std::array<int> a0 = {1,2,3}; // error size not specified
-    std::array<string,n> a1 = {"John's", "Queens' "}; // error: size not a constant expression
-    std::array<string,0> a2; // error: size must be positive
-    std::array<2> a3 = {"John's", "Queens' "}; // error: element type not stated
+    try {
+        return make_unique<Uring_backend>();
+    }
+    catch (const system_error&) { // no io_uring here (old kernel, or not allowed)
+        return make_unique<Pool_backend>();
+    }
 }
 
-// when you need the element count to be variable, use vector. std::array has a fixed element count
-
-// std::array can be passed to a C-style function that expects a pointer
+class Loop;
+
+// a coroutine that starts when the Loop gets to it
+// co_await task: run it and continue when it's done (the Task owns the coroutine)
+// loop.spawn(task): run it alongside; it cleans up after itself when done
+class Task {
+public:
+    struct promise_type {
+        Loop* loop = nullptr; // set for spawned tasks
+        coroutine_handle<> continuation;
+        exception_ptr error;
+
+        Task get_return_object() { return Task{coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept
+        {
+            struct Final {
+                bool await_ready() noexcept { return false; }
+                coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept
+                {
+                    auto& p = h.promise();
+                    if (p.loop) { // spawned: nobody holds the Task
+                        p.release(h);
+                        return noop_coroutine();
+                    }
+                    return p.continuation ? p.continuation : noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+        void return_void() {}
+        void unhandled_exception();
+        void release(coroutine_handle<promise_type> h) noexcept; // a spawned task is done: destroy it
+    };
+
+    Task(Task&& t) noexcept : h{exchange(t.h,nullptr)} {}
+    Task& operator=(Task&&) = delete;
+    ~Task() { if (h) h.destroy(); }
+
+    // co_await task
+    bool await_ready() const { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> caller)
+    {
+        h.promise().continuation = caller;
+        return h; // start the task right away
+    }
+    void await_resume()
+    {
+        if (h.promise().error)
+            rethrow_exception(h.promise().error);
+    }
+private:
+    friend class Loop;
+    explicit Task(coroutine_handle<promise_type> h) : h{h} {}
+    coroutine_handle<promise_type> h;
+};
 
-void f(int * p, int sz); // C-style inferface
+class Loop {
+public:
+    explicit Loop(Backend& io) : io{io} {}
 
-void g()
-{
-    std::array<int, 10> a;
+    Loop(const Loop&) = delete;
+    Loop& operator=(const Loop&) = delete;
+    ~Loop() { abandon(); }
 
-    f(a, a.size()); // error: no conversion
-    f(a.data(), a.size()); // C-style use
+    void spawn(Task t)
+    {
+        auto h = exchange(t.h,nullptr);
+        h.promise().loop = this;
+        spawned.insert(h.address());
+        post(h);
+    }
 
-    auto p = find(a, 777); //C++/STL-style use (a range is passed)
-}
+    void post(coroutine_handle<> h) { ready.push_back(h); }
 
-// why use array instead of vector
-// array is less flexible than vector, and thus simpler
-// sometimes, there is an advantage to accessing elements on the stack, instead of allocating them on the free store, accessing them indirectly through a vector, and then deallocating them
+    // until there's nothing left to do; rethrows the first exception from a spawned task,
+    // after abandoning the other tasks: their reads are waited for (the kernel or a pool thread may still be writing into
+    // their buffers) and then their frames are destroyed
+    void run()
+    {
+        vector<Io_request*> done;
+        for (;;) {
+            while (!ready.empty()) {
+                auto h = ready.front();
+                ready.pop_front();
+                h.resume();
+            }
+            if (error) {
+                abandon();
+                rethrow_exception(exchange(error,nullptr));
+            }
+            if (in_flight==0)
+                return; // done (or every task is waiting on a Channel that will never change: a bug in the tasks)
+            done.clear();
+            io.wait(done);
+            for (Io_request* r : done) {
+                --in_flight;
+                r->done = true;
+                if (r->waiter) post(r->waiter);
+            }
+        }
+    }
 
-// disadvantage: stack is limited, especially on embedded systems, and stack overflow is nasty
+    void start_read(Io_request& r, int fd, span<byte> buf, off_t off) // start it now, co_await wait(r) for the result later
+    {
+        r = Io_request{fd,buf.data(),buf.size(),off,0,false,nullptr};
+        try {
+            io.submit(&r);
+        }
+        catch (...) { // never started: a wait(r) must not wait for it, and neither must run() or abandon()
+            r.result = -ECANCELED;
+            r.done = true;
+            throw;
+        }
+        ++in_flight;
+    }
 
-// some application areas, like safety-critical real-time constrol, ban free-store allocation
-// use of delete and can lead to fragmentation or memory exhaustion
+    auto wait(Io_request& r) // co_await loop.wait(r): the number of bytes read, or -errno
+    {
+        struct Awaiter {
+            Io_request& r;
+            bool await_ready() const { return r.done; }
+            void await_suspend(coroutine_handle<> h) { r.waiter = h; }
+            ssize_t await_resume() const { return r.result; }
+        };
+        return Awaiter{r};
+    }
 
-// why use std:: array instead of built in array?
-// std::array knows its size and can be copied with =
-std::array<int,3> a1 = {1,2,3};
+    exception_ptr error;
+private:
+    friend struct Task::promise_type;
 
-auto a2 = a1; // copy
+    void abandon()
+    {
+        vector<Io_request*> done;
+        while (in_flight) {
+            done.clear();
+            io.wait(done);
+            in_flight -= done.size();
+        }
+        ready.clear();
+        for (void* p : exchange(spawned,{})) // a frame's Tasks destroy the frames it awaits
+            coroutine_handle<>::from_address(p).destroy();
+    }
 
-a2[1] = 5;
-a1 = a2; // assign
+    Backend& io;
+    deque<coroutine_handle<>> ready;
+    size_t in_flight = 0;
+    unordered_set<void*> spawned; // the frames of the spawned tasks not yet done (hash<coroutine_handle<>> is broken in gcc 12)
+};
 
-// std::arrays prevents nasty and unexpected conversions to ptrs
+inline void Task::promise_type::release(coroutine_handle<promise_type> h) noexcept
+{
+    loop->spawned.erase(h.address());
+    h.destroy();
+}
 
-// example involving a class hiearchy
-void h()
+inline void Task::promise_type::unhandled_exception()
 {
-    Circle a1[10];
-    std::array<Circle,10> s2;
-    // ..
-    Shape* p1 = a1; // Ok: disaster waiting to happen
-    Shape* p2 = a2; // error:no conversion of array<Circle,10> to Shape*(Good!)
-    p1[3].draw(); // disaster
+    if (loop) {
+        if (!loop->error) loop->error = current_exception();
+    }
+    else
+        error = current_exception();
 }
 
-// disaster comment assumes that sizeof(Shape)<sizeof(Circle), so subscripting Circle[] through a Shape* gives a wrong offset
-// all standard containers provide this advantage over built in arrays
+template<typename T>
+class Channel {
+public:
+    Channel(Loop& loop, size_t capacity) : loop{loop}, cap{capacity} {}
 
-// 15.3.2 bitset
+    auto push(T x) // co_await ch.push(x)
+    {
+        struct Awaiter {
+            Channel& ch;
+            T x;
+            bool await_ready()
+            {
+                if (ch.q.size()==ch.cap)
+                    return false;
+                ch.q.push_back(move(x));
+                ch.wake(ch.consumer);
+                return true;
+            }
+            void await_suspend(coroutine_handle<> h) { ch.producer = h; ch.parked = &x; }
+            void await_resume() {}
+        };
+        return Awaiter{*this,move(x)};
+    }
 
-// aspects of the system, like state of the input stream, are often represented as a set of flags indicating binary conditions
-// such as good/bad, true/false and on/off
+    auto pop() // co_await ch.pop(): the next element, or nullopt once the channel is closed and empty
+    {
+        struct Awaiter {
+            Channel& ch;
+            bool await_ready() const { return !ch.q.empty() || ch.closed; }
+            void await_suspend(coroutine_handle<> h) { ch.consumer = h; }
+            optional<T> await_resume()
+            {
+                if (ch.q.empty())
+                    return nullopt;
+                optional<T> x {move(ch.q.front())};
+                ch.q.pop_front();
+                if (ch.parked) { // a producer waits for room: take its element and let it go on
+                    ch.q.push_back(move(*exchange(ch.parked,nullptr)));
+                    ch.wake(ch.producer);
+                }
+                return x;
+            }
+        };
+        return Awaiter{*this};
+    }
+
+    void close() // no more elements; the consumer sees nullopt after the last one
+    {
+        closed = true;
+        wake(consumer);
+    }
+private:
+    void wake(coroutine_handle<>& h)
+    {
+        if (h) loop.post(exchange(h,nullptr));
+    }
+
+    Loop& loop;
+    size_t cap;
+    deque<T> q;
+    bool closed = false;
+    coroutine_handle<> producer; // one producer and one consumer at a time
+    coroutine_handle<> consumer;
+    T* parked = nullptr; // the waiting producer's element
+};
+
+class Async_file {
+public:
+    explicit Async_file(const string& name) : fd{::open(name.c_str(),O_RDONLY)}
+    {
+        struct stat st;
+        if (fd<0 || ::fstat(fd,&st)<0) {
+            if (fd>=0) ::close(fd);
+            throw No_file{};
+        }
+        sz = st.st_size;
+    }
+    Async_file(const Async_file&) = delete;
+    Async_file& operator=(const Async_file&) = delete;
+    ~Async_file() { ::close(fd); }
+
+    int handle() const { return fd; }
+    size_t size() const { return sz; }
+private:
+    int fd;
+    size_t sz;
+};
+
+struct Chunk {
+    vector<byte> buf;
+    size_t size = 0; // bytes of buf in use
+    off_t off = 0; // where in the file they came from
+};
+
+// stage f: read the file in order, with up to depth reads in flight
+// buffers come from empty and go to full: depth buffers in all, so memory stays bounded however slow g is
+// however f ends, it first waits for the reads it started, since the kernel (or a pool thread) may still be writing
+// into their buffers, and then closes full, so that g always finishes
+Task f(Loop& loop, shared_ptr<Async_file> fp, Channel<Chunk>& full, Channel<Chunk>& empty, size_t depth)
+{
+    struct Pending {
+        Chunk chunk;
+        Io_request req;
+    };
+    deque<Pending> pending; // in file order; push_back() and pop_front() leave the other elements where they are
+    exception_ptr failed; // no co_await in a handler, so keep the exception until the reads are done
+    try {
+        size_t off = 0;
+        while (off<fp->size() || !pending.empty()) {
+            while (pending.size()<depth && off<fp->size()) { // read ahead
+                Chunk c = *co_await empty.pop();
+                size_t len = min(c.buf.size(),fp->size()-off);
+                auto& p = pending.emplace_back(move(c));
+                p.chunk.off = off;
+                loop.start_read(p.req,fp->handle(),span{p.chunk.buf}.first(len),off);
+                off += len;
+            }
+            auto& p = pending.front();
+            ssize_t n = co_await loop.wait(p.req);
+            if (n<0) {
+                pending.pop_front();
+                throw system_error{int(-n),system_category(),"read"};
+            }
+            p.chunk.size = n; // a short read only at the end of a file that shrank under us
+            co_await full.push(move(p.chunk));
+            pending.pop_front();
+        }
+    }
+    catch (...) {
+        failed = current_exception();
+    }
+    for (auto& p : pending) // a read that was never started is already done
+        co_await loop.wait(p.req);
+    full.close();
+    if (failed)
+        rethrow_exception(failed);
+}
+
+// stage g: use each chunk, then give the buffer back to f
+Task g(shared_ptr<Async_file> fp, Channel<Chunk>& full, Channel<Chunk>& empty, Channel<uint64_t>& result)
+{
+    uint64_t sum = 0;
+    while (auto c = co_await full.pop()) {
+        for (byte b : span{c->buf}.first(c->size))
+            sum = sum*31+to_integer<unsigned>(b); // a checksum, for something to do
+        co_await empty.push(move(*c));
+    }
+    fp.reset(); // the last user closes the file
+    co_await result.push(sum);
+}
+
+// user(), asynchronously: f and g run as a pipeline over the same file
+// fp is handed to the stages, so the file is closed when the last of them is done with it, not when user_async() returns
+// name is taken by value: the Task starts later, when a temporary string passed as name would be gone
+Task user_async(Loop& loop, string name, uint64_t& sum, size_t depth = 4, size_t chunk = 256<<10)
+{
+    auto fp = make_shared<Async_file>(name); // throws No_file
+    Channel<Chunk> full {loop,depth};
+    Channel<Chunk> empty {loop,depth};
+    Channel<uint64_t> result {loop,1};
+    for (size_t i = 0; i<depth; ++i) {
+        Chunk c {vector<byte>(chunk)}; // not a temporary in the co_await: gcc 12 destroys that too early
+        co_await empty.push(move(c));
+    }
+
+    loop.spawn(g(fp,full,empty,result));
+    exception_ptr failed; // no co_await in a handler, so keep the exception until g is done
+    try {
+        co_await f(loop,move(fp),full,empty,depth);
+    }
+    catch (...) {
+        failed = current_exception();
+    }
+    sum = *co_await result.pop(); // g is done: f closed full, however it ended, and g no longer uses our Channels
+    if (failed)
+        rethrow_exception(failed);
+}
+
+} // namespace aio
+
+// benchmark: read and checksum many files, with user()'s blocking f then g, and with the pipeline
+// files at a time: one for blocking, files_in_parallel for the pipeline (each with depth reads in flight)
+// the files are evicted from the page cache before each run, so the reads really wait for the device and the pipeline
+// has something to overlap; without that, a read is just a copy, and the blocking version is as fast or faster
+// (the eviction is a hint: a file system may keep the pages anyway, and then the runs measure copies)
+
+void evict(const vector<string>& names) // write the files out, then drop their pages from the cache
+{
+    for (const string& name : names) {
+        int fd = ::open(name.c_str(),O_RDONLY);
+        if (fd<0)
+            throw No_file{};
+        ::fdatasync(fd); // dirty pages can't be dropped
+        ::posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+}
+
+uint64_t checksum_blocking(const string& name, size_t chunk = 256<<10)
+{
+    auto fp = make_shared<fstream>(name,ios::in|ios::binary);
+    if (!*fp)
+        throw No_file{};
+    vector<char> buf(chunk);
+    uint64_t sum = 0;
+    while (fp->read(buf.data(),buf.size()) || fp->gcount())
+        for (char c : span{buf.data(),size_t(fp->gcount())})
+            sum = sum*31+static_cast<unsigned char>(c);
+    return sum;
+}
+
+void bench_async_files(size_t files = 256, size_t file_size = 1<<20, size_t files_in_parallel = 16)
+{
+    auto dir = filesystem::temp_directory_path()/"notes_async";
+    filesystem::create_directories(dir);
+    vector<string> names;
+    {
+        vector<char> block(file_size);
+        mt19937 gen;
+        for (size_t i = 0; i<files; ++i) {
+            for (char& c : block) c = char(gen());
+            names.push_back((dir/("f"+to_string(i))).string());
+            ofstream {names.back(),ios::binary}.write(block.data(),block.size());
+        }
+    }
+
+    auto report = [&](const char* label, chrono::duration<double> total, vector<double>& latency) {
+        ranges::sort(latency);
+        cout << label << files*file_size/total.count()/(1<<20) << " MB/s, latency per file: median "
+             << latency[latency.size()/2] << " ms, 99% " << latency[latency.size()*99/100] << " ms, max " << latency.back() << " ms\n";
+    };
+
+    vector<uint64_t> expected(files);
+    {
+        evict(names);
+        vector<double> latency;
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i<files; ++i) {
+            auto t = chrono::steady_clock::now();
+            expected[i] = checksum_blocking(names[i]);
+            latency.push_back(chrono::duration<double,milli>(chrono::steady_clock::now()-t).count());
+        }
+        report("fstream, f then g:     ",chrono::steady_clock::now()-t0,latency);
+    }
+
+    auto run = [&](aio::Backend& io) {
+        aio::Loop loop {io};
+        vector<uint64_t> sums(files);
+        vector<double> latency(files);
+        size_t next = 0;
+        auto worker = [&]() -> aio::Task { // files_in_parallel of these take the files in turn
+            while (next<files) {
+                size_t i = next++;
+                auto t = chrono::steady_clock::now();
+                co_await aio::user_async(loop,names[i],sums[i]);
+                latency[i] = chrono::duration<double,milli>(chrono::steady_clock::now()-t).count();
+            }
+        };
+        evict(names);
+        auto t0 = chrono::steady_clock::now();
+        for (size_t w = 0; w<files_in_parallel; ++w)
+            loop.spawn(worker());
+        loop.run();
+        auto total = chrono::steady_clock::now()-t0;
+        if (sums!=expected)
+            throw logic_error{"async checksums differ"};
+        string label = string{"pipeline, "}+io.name()+":";
+        label.resize(23,' ');
+        report(label.c_str(),total,latency);
+    };
+
+    optional<aio::Uring_backend> uring;
+    try {
+        uring.emplace();
+    }
+    catch (const system_error& e) { // only the setup: an error during the run is an error
+        cout << "io_uring not available: " << e.what() << '\n';
+    }
+    if (uring)
+        run(*uring);
+    aio::Pool_backend pool;
+    run(pool);
+
+    filesystem::remove_all(dir);
+}
+
+// creating an object on the free store, assinging it to a ptr, and then passing the ptr to a smart ptr is verbose
+// it allows for mistakes, like forgetting to pass the ptr to a unique_ptr or giving the ptr to something that isn't on the free store to shared_ptr
+
+// to avoid these problems, the std provides functions for constructing an object and then returning an appropriate smart ptr
+// these are make_shared and make_unique functions
+
+struct S {
+    int i;
+    string s;
+    double d;
+    // ..
+};
+
+auto p1 = make_shared<S>(1,"Ankh Morpork", 4.65); // p1 is a shared_ptr<S>
+auto p2 = make_unique<S>(2, "Oz",7.62); // p2 is a unique_ptr<S>
+
+// p2 is a unique_tr<S> pointing to a free-store allocated object of type S with the value {2, "Oz",7.62}.
+
+// using make_shared() is not just more convenient than seperatly making an object using new and then passing
+// it to shared_ptr - it is also notable more efficient because it does not need a seperate allocation for the 
+// use count that is essential in the implementation of shared_ptr
+
+// make_unique and make_shared still do one general-purpose free store allocation per object
+// when we create millions of short-lived objects, the allocator itself shows up in the profile
+
+// an arena grabs memory in big chunks and hands out pieces of it
+// the pool recycles the pieces we give back, the monotonic buffer below it never frees until the arena dies
+// so allocation and deallocation are a few instructions each, and teardown is one release of a few chunks
+
+class Arena {
+public:
+    explicit Arena(size_t chunk = 64*1024) : mono{chunk}, pool{&mono} {}
+
+    Arena(const Arena&) = delete; // objects in the arena point into it
+    Arena& operator=(const Arena&) = delete;
+
+    pmr::memory_resource* resource() { return &pool; }
+    void release() { pool.release(); mono.release(); } // every object in the arena must be gone
+private:
+    pmr::monotonic_buffer_resource mono;
+    pmr::unsynchronized_pool_resource pool; // not thread safe: one arena per thread or per request
+};
+
+// the deleter destroys the object and gives the memory back to the arena it came from
+template<typename T>
+struct Arena_deleter {
+    pmr::memory_resource* r;
+    void operator()(T* p) const
+    {
+        p->~T();
+        r->deallocate(p,sizeof(T),alignof(T));
+    }
+};
+
+template<typename T>
+using arena_ptr = unique_ptr<T,Arena_deleter<T>>;
+
+template<typename T, typename... Args>
+arena_ptr<T> make_arena(Arena& a, Args&&... args) // like make_unique, but in a
+{
+    auto r = a.resource();
+    void* mem = r->allocate(sizeof(T),alignof(T));
+    try {
+        return arena_ptr<T>{new(mem) T{forward<Args>(args)...}, Arena_deleter<T>{r}};
+    }
+    catch (...) {
+        r->deallocate(mem,sizeof(T),alignof(T));
+        throw;
+    }
+}
+
+// factory overloads for the examples above
+
+arena_ptr<X> make_X(Arena& a, int i)
+{
+    // .. check i, etc ...
+    return make_arena<X>(a,i);
+}
+
+Arena arena;
+auto p3 = make_arena<S>(arena,3,"Lancre",1.5); // p3 is an arena_ptr<S>
+
+// the shared_ptr version: allocate_shared puts the object and the use count into the arena in one piece
+auto p4 = allocate_shared<S>(pmr::polymorphic_allocator<S>{arena.resource()},4,"Quirm",2.25);
+
+// the arena must outlive every arena_ptr and shared_ptr into it
+// S's string still allocates on the free store unless it's short enough for the small string optimization
+// use pmr::string in S if that matters too
+
+// benchmark: create n objects, then destroy them, with plain new and with the arena
+template<typename Make>
+double time_per_object(int n, Make make)
+{
+    auto t0 = chrono::steady_clock::now();
+    {
+        vector<decltype(make(0))> v;
+        v.reserve(n);
+        for (int i = 0; i<n; ++i)
+            v.push_back(make(i));
+    } // teardown is timed too
+    chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+    return d.count()/n;
+}
+
+void bench_arena()
+{
+    for (int n : {1'000, 100'000, 1'000'000}) {
+        Arena a;
+        double heap = time_per_object(n,[](int i) { return unique_ptr<X>(new X{i}); });
+        double pool = time_per_object(n,[&a](int i) { return make_X(a,i); });
+        cout << n << " objects: new " << heap << " ns, arena " << pool << " ns per object\n";
+    }
+}
+
+// leaks and shared lifetimes are "tough to predict", and we can't see them in a running program
+// we can record them: which call site allocated what, how long each object lived, how many bytes were live at the peak,
+// and how often a shared_ptr was copied and destroyed (the refcount traffic)
+
+// the recording is opt-in: build with -DNOTES_TRACK_OWNERSHIP=1
+// then NOTES_MAKE_UNIQUE(T,args) and NOTES_MAKE_SHARED(T,args) record, and without it they are exactly make_unique<T>(args) and make_shared<T>(args)
+// they're macros so that they can pick up the call site (a function can't have a default source_location after a parameter pack)
+// the pointer types differ when recording (the deleter and the shared handle record too), so use auto,
+// or tracked_unique_ptr<T> and tracked_shared_ptr<T>, which are plain unique_ptr<T> and shared_ptr<T> when recording is off
+
+#ifndef NOTES_TRACK_OWNERSHIP
+#define NOTES_TRACK_OWNERSHIP 0
+#endif
+
+namespace track {
+
+enum class Kind : uint8_t { alloc, free, share, unshare };
+
+struct Event {
+    Kind kind;
+    uint32_t bytes; // for alloc and free
+    const void* p; // the object (alloc, free) or the shared block (share, unshare)
+    const char* type;
+    source_location site; // where it was made
+    uint64_t ns; // since the first event
+};
+
+// each thread appends to its own log: no lock, and no cache line shared with other threads
+// a log is a linked list of blocks, so an append never moves earlier events
+// the logs outlive their threads, so a report can include threads that are gone
+// an append publishes the event with a release store of its block's count (and a new block with a release store of next),
+// and a reader loads them with acquire, so report() and chrome_trace() can run while other threads still record:
+// they see the events published so far
+
+class Thread_log {
+public:
+    Thread_log() : head{new Block}, tail{head} {} // not recorded: this isn't one of ours
+    Thread_log(const Thread_log&) = delete;
+    Thread_log& operator=(const Thread_log&) = delete;
+    ~Thread_log()
+    {
+        for (Block* b = head; b;)
+            delete exchange(b,b->next.load(memory_order_relaxed));
+    }
+
+    void append(const Event& e) // only the owning thread appends
+    {
+        size_t n = tail->n.load(memory_order_relaxed);
+        if (n==block_size) {
+            Block* b = new Block;
+            tail->next.store(b,memory_order_release);
+            tail = b;
+            n = 0;
+        }
+        tail->events[n] = e;
+        tail->n.store(n+1,memory_order_release);
+    }
+
+    template<typename F>
+    void for_each(F f) const
+    {
+        for (const Block* b = head; b; b = b->next.load(memory_order_acquire))
+            for (size_t i = 0, m = b->n.load(memory_order_acquire); i<m; ++i)
+                f(b->events[i]);
+    }
+private:
+    static constexpr size_t block_size = 4096;
+    struct Block {
+        Event events[block_size];
+        atomic<size_t> n {0};
+        atomic<Block*> next {nullptr};
+    };
+    Block* const head;
+    Block* tail; // the owning thread's
+};
+
+class Registry {
+public:
+    static Registry& get()
+    {
+        static Registry r;
+        return r;
+    }
+
+    Thread_log& this_thread() // the lock is taken once per thread, the first time it records
+    {
+        thread_local Thread_log* log = [this] {
+            scoped_lock lck {m};
+            logs.push_back(std::make_unique<Thread_log>());
+            return logs.back().get();
+        }();
+        return *log;
+    }
+
+    vector<vector<Event>> snapshot() const // one vector per thread
+    {
+        scoped_lock lck {m};
+        vector<vector<Event>> r;
+        for (auto& log : logs)
+            log->for_each([&r,first = true](const Event& e) mutable {
+                if (exchange(first,false)) r.emplace_back();
+                r.back().push_back(e);
+            });
+        return r;
+    }
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+private:
+    mutable mutex m;
+    vector<unique_ptr<Thread_log>> logs;
+};
+
+inline void record(Kind k, const void* p, size_t bytes, const char* type, const source_location& site)
+{
+    auto& r = Registry::get();
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-r.start).count();
+    r.this_thread().append({k,uint32_t(bytes),p,type,site,ns});
+}
+
+// unique_ptr: the deleter remembers the site and records the free
+template<typename T>
+struct Deleter {
+    source_location site;
+    void operator()(T* p) const
+    {
+        record(Kind::free,p,sizeof(T),typeid(T).name(),site);
+        delete p;
+    }
+};
+
+template<typename T, typename... Args>
+unique_ptr<T,Deleter<T>> make_unique(source_location site, Args&&... args)
+{
+    unique_ptr<T,Deleter<T>> p {new T(forward<Args>(args)...),Deleter<T>{site}};
+    record(Kind::alloc,p.get(),sizeof(T),typeid(T).name(),site);
+    return p;
+}
+
+// shared_ptr: allocate_shared with an allocator that records the one allocation of object and use count together
+template<typename T>
+struct Allocator {
+    using value_type = T;
+    source_location site;
+    const char* type;
+
+    Allocator(source_location site, const char* type) : site{site}, type{type} {}
+    template<typename U>
+    Allocator(const Allocator<U>& a) : site{a.site}, type{a.type} {}
+
+    T* allocate(size_t n)
+    {
+        T* p = std::allocator<T>{}.allocate(n);
+        record(Kind::alloc,p,n*sizeof(T),type,site);
+        return p;
+    }
+    void deallocate(T* p, size_t n)
+    {
+        record(Kind::free,p,n*sizeof(T),type,site);
+        std::allocator<T>{}.deallocate(p,n);
+    }
+    template<typename U>
+    bool operator==(const Allocator<U>&) const { return true; }
+};
+
+// and a shared_ptr that records each copy (an increment of the use count) and each release (a decrement)
+template<typename T>
+class Shared {
+public:
+    Shared() = default;
+    Shared(shared_ptr<T> p, source_location site) : p{move(p)}, site{site} {}
+    Shared(const Shared& s) : p{s.p}, site{s.site} { note(Kind::share); }
+    Shared(Shared&& s) noexcept = default; // a move doesn't touch the count
+    Shared& operator=(const Shared& s) { Shared tmp {s}; swap(p,tmp.p); swap(site,tmp.site); return *this; }
+    Shared& operator=(Shared&& s) noexcept { Shared tmp {move(s)}; swap(p,tmp.p); swap(site,tmp.site); return *this; }
+    ~Shared() { note(Kind::unshare); }
+
+    T& operator*() const { return *p; }
+    T* operator->() const { return p.get(); }
+    T* get() const { return p.get(); }
+    long use_count() const { return p.use_count(); }
+    explicit operator bool() const { return bool(p); }
+private:
+    void note(Kind k) const { if (p) record(k,p.get(),0,typeid(T).name(),site); }
+    shared_ptr<T> p;
+    source_location site;
+};
+
+template<typename T, typename... Args>
+Shared<T> make_shared(source_location site, Args&&... args)
+{
+    return {allocate_shared<T>(Allocator<T>{site,typeid(T).name()},forward<Args>(args)...),site};
+}
+
+// per call site: allocations, frees, live objects at the end (leaks, unless they're still in use), lifetimes, copies
+// overall: the peak of live bytes over time
+inline void report(ostream& os)
+{
+    struct Stats {
+        size_t allocs = 0, frees = 0, bytes = 0, shares = 0, unshares = 0;
+        uint64_t total_life = 0, max_life = 0;
+    };
+    map<pair<string,unsigned>,Stats> sites; // (file,line)
+    map<const void*,uint64_t> born; // live objects: when they were allocated
+
+    vector<Event> all;
+    for (auto& t : Registry::get().snapshot())
+        all.insert(all.end(),t.begin(),t.end());
+    ranges::sort(all,{},&Event::ns); // one timeline, for the peak
+
+    size_t live = 0, peak = 0;
+    for (const Event& e : all) {
+        Stats& s = sites[{e.site.file_name(),unsigned(e.site.line())}];
+        switch (e.kind) {
+        case Kind::alloc:
+            ++s.allocs;
+            s.bytes += e.bytes;
+            born[e.p] = e.ns;
+            peak = max(peak,live += e.bytes);
+            break;
+        case Kind::free:
+            if (auto b = born.find(e.p); b!=born.end()) {
+                ++s.frees;
+                uint64_t life = e.ns-b->second;
+                s.total_life += life;
+                s.max_life = max(s.max_life,life);
+                live -= e.bytes;
+                born.erase(b);
+            }
+            break;
+        case Kind::share: ++s.shares; break;
+        case Kind::unshare: ++s.unshares; break;
+        }
+    }
+
+    os << "peak live bytes: " << peak << ", live at end: " << live << '\n';
+    for (const auto& [site,s] : sites) {
+        os << site.first << ':' << site.second << ": " << s.allocs << " allocations (" << s.bytes << " bytes), "
+           << s.allocs-s.frees << " still live";
+        if (s.frees)
+            os << ", lifetime mean " << s.total_life/s.frees/1000.0 << " us max " << s.max_life/1000.0 << " us";
+        if (s.shares || s.unshares)
+            os << ", " << s.shares << " copies " << s.unshares << " releases";
+        os << '\n';
+    }
+}
+
+// the same events for chrome://tracing (or ui.perfetto.dev): each object is an async slice from allocation to free,
+// the copies and releases are instant events, and live bytes is a counter
+inline void chrome_trace(ostream& os)
+{
+    auto threads = Registry::get().snapshot();
+    os << "{\"traceEvents\":[\n";
+    const char* sep = "";
+    size_t live = 0;
+    vector<pair<uint64_t,long long>> deltas; // (time,change in live bytes)
+    for (size_t tid = 0; tid<threads.size(); ++tid)
+        for (const Event& e : threads[tid]) {
+            static constexpr const char* phase[] = {"b","e","i","i"};
+            static constexpr const char* name[] = {"object","object","copy","release"};
+            os << sep << "{\"name\":\"" << name[int(e.kind)] << ' ' << e.type << "\",\"cat\":\"" << e.site.file_name() << ':' << e.site.line()
+               << "\",\"ph\":\"" << phase[int(e.kind)] << "\",\"id\":\"" << e.p << "\",\"ts\":" << e.ns/1000.0
+               << ",\"pid\":1,\"tid\":" << tid << (e.kind>=Kind::share ? ",\"s\":\"t\"}" : "}");
+            sep = ",\n";
+            if (e.kind==Kind::alloc) deltas.emplace_back(e.ns,e.bytes);
+            if (e.kind==Kind::free) deltas.emplace_back(e.ns,-(long long)e.bytes);
+        }
+    ranges::sort(deltas);
+    for (auto [ns,d] : deltas) {
+        live += d;
+        os << sep << "{\"name\":\"live bytes\",\"ph\":\"C\",\"ts\":" << ns/1000.0 << ",\"pid\":1,\"args\":{\"bytes\":" << live << "}}";
+    }
+    os << "\n]}\n";
+}
+
+} // namespace track
+
+#if NOTES_TRACK_OWNERSHIP
+#define NOTES_MAKE_UNIQUE(T,...) track::make_unique<T>(source_location::current() __VA_OPT__(,) __VA_ARGS__)
+#define NOTES_MAKE_SHARED(T,...) track::make_shared<T>(source_location::current() __VA_OPT__(,) __VA_ARGS__)
+template<typename T>
+using tracked_unique_ptr = unique_ptr<T,track::Deleter<T>>;
+template<typename T>
+using tracked_shared_ptr = track::Shared<T>;
+#else
+#define NOTES_MAKE_UNIQUE(T,...) std::make_unique<T>(__VA_ARGS__)
+#define NOTES_MAKE_SHARED(T,...) std::make_shared<T>(__VA_ARGS__)
+template<typename T>
+using tracked_unique_ptr = unique_ptr<T>;
+template<typename T>
+using tracked_shared_ptr = shared_ptr<T>;
+#endif
+
+// make_X() and user() with recording; with it off, these are make_X() and user() from above
+
+// the site parameter exists only when recording, so with it off a call passes (and builds) nothing extra
+#if NOTES_TRACK_OWNERSHIP
+tracked_unique_ptr<X> make_X_tracked(int i, source_location site = source_location::current())
+{
+    // .. check i, etc ...
+    return track::make_unique<X>(site,i); // recorded at make_X_tracked()'s caller
+}
+#else
+tracked_unique_ptr<X> make_X_tracked(int i)
+{
+    // .. check i, etc ...
+    return make_unique<X>(i);
+}
+#endif
+
+void f(tracked_shared_ptr<fstream>);
+void g(tracked_shared_ptr<fstream>);
+
+void user_tracked(const string& name, ios_base::openmode mode)
+{
+    auto fp = NOTES_MAKE_SHARED(fstream,name,mode); // one allocation; each copy into f() and g() is recorded
+    if (!*fp)
+        throw No_file{};
+
+    f(fp);
+    g(fp);
+}
+
+// at the end of main() (not in a signal handler: report() and chrome_trace() lock, allocate, and use iostreams):
+//   track::report(cerr);
+//   ofstream trace {"ownership.json"}; track::chrome_trace(trace);
+
+// benchmark: n objects made and destroyed through NOTES_MAKE_UNIQUE, NOTES_MAKE_SHARED, and make_X_tracked(), and directly
+// compile it with and without -DNOTES_TRACK_OWNERSHIP=1: without, the two lines of each pair should be the same
+// (the macros expand to the direct calls, and make_X_tracked() loses its site parameter, so the code is identical)
+
+void bench_tracking(int n = 1'000'000)
+{
+    auto time = [n](const char* label, auto make) {
+        auto t0 = chrono::steady_clock::now();
+        long long sum = 0;
+        for (int i = 0; i<n; ++i) {
+            auto p = make(i);
+            sum += p->i;
+        }
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/n << " ns per object (" << sum << ")\n";
+    };
+
+    cout << "recording " << (NOTES_TRACK_OWNERSHIP ? "on" : "off") << '\n';
+    time("make_unique:       ",[](int i) { return make_unique<X>(i); });
+    time("NOTES_MAKE_UNIQUE: ",[](int i) { return NOTES_MAKE_UNIQUE(X,i); });
+    time("make_shared:       ",[](int i) { return make_shared<X>(i); });
+    time("NOTES_MAKE_SHARED: ",[](int i) { return NOTES_MAKE_SHARED(X,i); });
+    time("make_X():          ",[](int i) { return make_X(i); });
+    time("make_X_tracked():  ",[](int i) { return make_X_tracked(i); });
+}
+
+// with unique_ptr and shared_ptr, we can implement a "no naked new" policy for many programs
+
+// but, favor containers that manager their own resources of unique_ptr and shared_ptr
+// they're still conceptually ptrs
+
+// shared_prs don't provide rules to control access to the shared object
+// data races and other forms of confusions still exists when using shared_ptrs
+
+// use unique_ptr rather than resource handles when we need ptr semantics
+
+// when we shared an object, we need ptrs or references to refer to the object. shared_ptr is the obvious choice here
+// when we refer to a polymorpgic object in classical object-oriented code, we need a pointer or ref because know the exact type of the object referred to or its size. use unique_ptr
+// shared polymorphic objects usually require shared_ptrs
+
+// we don't need to use a pointer to return a collection of objects from a function. 
+// a container will do that simply and efficiently with copy elison and move semantics
+
+// 15.2.2 span
+// range errors cause a lot of problems in C and C++
+// containers, algos, and range-for can reduce these problems
+// big soure of range errors: passing ptrs (raw or smart) and then relying on convention to know the number of elements pointed to
+
+// best advice for code outside resource handles is to assume that at most one object is pointed to but without support that advice is unmanageable
+// string_view can help, but it's read-only and just for characters
+
+// when writing into and reading out of buggers in lower-level software, it's difficult to maintain high performance
+// while still avoiding range errors ("buffer overruns")
+
+// a span is a (pointer,length) pair denoting a sequence of elements
+
+// span gives access to contiguous sequences of elements
+
+// these elements can be stored in many ways, including vectors and built in arrays
+
+// like ptrs, span's don't own the characters they point to
+
+// it is thus similar to string_view
+
+// a common interface style
+void fpn(int* p, int n)
+{
+    for (int i = 0; i<n; ++i)
+        p[i] = 0;
+}
+
+// we can assume that *p points to n integers
+// this assumption is just a convetion, so can't use it to write a range-for loop and the compiler can't implement cheap and efficient range checking
+// this assumption can also be wrong
+
+void use(int x)
+{
+    int a[100]; // Ok
+    fpn (a,1000); // woops, my finger slipped
+    fpn (a+10,100); // range error in fpn;
+    fpn(a,x); // suspect, but looks innocent
+}
+
+// span can prevent these kinds of errors
+void fs(span<int> p)
+{
+    for (int& x : p)
+        x = 0;
+}
+
+void use(int x)
+{
+    int a[100];
+    fs(a); // implicitly creates a span<int>{a,100}
+    fs(a,1000); // error: span expected
+    fs({a+10,100}); // a range error in fs
+    fs({a,x}); // obviously suspect
+}
+
+// the common case of creating a span from an array is now safe and notationally simple
+// explicitly composiing a span makes error-detection easier. 
+
+// common case where a span is passed along from function to function is simpler than (poiner,count) interfaces and doesn't require extra checking
+
+void f1(span<int> p);
+
+void fs(span<int> p)
+{
+    // ..
+    f1(p);
+}
+
+// when span is used for subscripting, range checking isn't done and out-of-range access is undefined behaivor
+// an implementation to implement range checking when subscripting, but few do
+// the original gsl::span from the Core Guidelines support lib does range checking
+
+// span gives us the size, so a loop over a span is a good place for bulk operations
+// a compiler often vectorizes simple loops like the one in fs(), but not reliably (sum, min/max, find usually aren't)
+// explicit SSE2/AVX2 versions get vector throughput and still never go past the end of the span
+
+// the kernels pick the widest instruction set the CPU supports at run time
+// x86-64 with gcc or clang only (<immintrin.h>, __builtin_cpu_supports, target attributes); everything else gets the scalar loops
+
+namespace bulk {
+
+enum class Isa { scalar, sse2, avx2 };
+
+inline Isa detect()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::avx2;
+    return Isa::sse2; // every x86-64 has SSE2
+#else
+    return Isa::scalar;
+#endif
+}
+
+inline Isa active = detect(); // can be set to compare the versions
+
+// scalar versions: also handle the tails the vector loops leave over
+
+inline void fill_scalar(int* p, size_t n, int v) { for (size_t i = 0; i<n; ++i) p[i] = v; }
+
+inline long long sum_scalar(const int* p, size_t n)
+{
+    long long s = 0;
+    for (size_t i = 0; i<n; ++i) s += p[i];
+    return s;
+}
+
+inline pair<int,int> min_max_scalar(const int* p, size_t n, pair<int,int> mm)
+{
+    for (size_t i = 0; i<n; ++i) {
+        mm.first = min(mm.first,p[i]);
+        mm.second = max(mm.second,p[i]);
+    }
+    return mm;
+}
+
+inline size_t find_scalar(const int* p, size_t n, int v)
+{
+    size_t i = 0;
+    while (i<n && p[i]!=v) ++i;
+    return i;
+}
+
+#if defined(__x86_64__)
+
+inline void fill_sse2(int* p, size_t n, int v)
+{
+    __m128i x = _mm_set1_epi32(v);
+    size_t i = 0;
+    for (; i+4<=n; i += 4) _mm_storeu_si128((__m128i*)(p+i),x);
+    fill_scalar(p+i,n-i,v);
+}
+
+__attribute__((target("avx2"))) inline void fill_avx2(int* p, size_t n, int v)
+{
+    __m256i x = _mm256_set1_epi32(v);
+    size_t i = 0;
+    for (; i+8<=n; i += 8) _mm256_storeu_si256((__m256i*)(p+i),x);
+    fill_scalar(p+i,n-i,v);
+}
+
+inline void copy_sse2(const int* from, int* to, size_t n)
+{
+    size_t i = 0;
+    for (; i+4<=n; i += 4) _mm_storeu_si128((__m128i*)(to+i),_mm_loadu_si128((const __m128i*)(from+i)));
+    for (; i<n; ++i) to[i] = from[i];
+}
+
+__attribute__((target("avx2"))) inline void copy_avx2(const int* from, int* to, size_t n)
+{
+    size_t i = 0;
+    for (; i+8<=n; i += 8) _mm256_storeu_si256((__m256i*)(to+i),_mm256_loadu_si256((const __m256i*)(from+i)));
+    for (; i<n; ++i) to[i] = from[i];
+}
+
+inline long long sum_sse2(const int* p, size_t n)
+{
+    __m128i acc = _mm_setzero_si128(); // two 64-bit sums, so we can't overflow
+    size_t i = 0;
+    for (; i+4<=n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p+i));
+        __m128i sign = _mm_srai_epi32(x,31); // SSE2 has no sign extension instruction
+        acc = _mm_add_epi64(acc,_mm_unpacklo_epi32(x,sign));
+        acc = _mm_add_epi64(acc,_mm_unpackhi_epi32(x,sign));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes,acc);
+    return lanes[0]+lanes[1]+sum_scalar(p+i,n-i);
+}
+
+__attribute__((target("avx2"))) inline long long sum_avx2(const int* p, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256(); // four 64-bit sums
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p+i));
+        acc = _mm256_add_epi64(acc,_mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        acc = _mm256_add_epi64(acc,_mm256_cvtepi32_epi64(_mm256_extracti128_si256(x,1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+sum_scalar(p+i,n-i);
+}
+
+inline pair<int,int> min_max_sse2(const int* p, size_t n)
+{
+    pair mm {INT_MAX,INT_MIN};
+    size_t i = 0;
+    if (n>=4) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)p);
+        __m128i hi = lo;
+        for (i = 4; i+4<=n; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(p+i));
+            __m128i lt = _mm_cmplt_epi32(x,lo); // SSE2 has no min/max for 32-bit ints: select with masks
+            lo = _mm_or_si128(_mm_and_si128(lt,x),_mm_andnot_si128(lt,lo));
+            __m128i gt = _mm_cmpgt_epi32(x,hi);
+            hi = _mm_or_si128(_mm_and_si128(gt,x),_mm_andnot_si128(gt,hi));
+        }
+        int l[4], h[4];
+        _mm_storeu_si128((__m128i*)l,lo);
+        _mm_storeu_si128((__m128i*)h,hi);
+        mm = min_max_scalar(l,4,mm);
+        mm = min_max_scalar(h,4,mm);
+    }
+    return min_max_scalar(p+i,n-i,mm);
+}
+
+__attribute__((target("avx2"))) inline pair<int,int> min_max_avx2(const int* p, size_t n)
+{
+    pair mm {INT_MAX,INT_MIN};
+    size_t i = 0;
+    if (n>=8) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi = lo;
+        for (i = 8; i+8<=n; i += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(p+i));
+            lo = _mm256_min_epi32(lo,x);
+            hi = _mm256_max_epi32(hi,x);
+        }
+        int l[8], h[8];
+        _mm256_storeu_si256((__m256i*)l,lo);
+        _mm256_storeu_si256((__m256i*)h,hi);
+        mm = min_max_scalar(l,8,mm);
+        mm = min_max_scalar(h,8,mm);
+    }
+    return min_max_scalar(p+i,n-i,mm);
+}
+
+inline size_t mismatch_sse2(const int* a, const int* b, size_t n) // index of the first difference, or n
+{
+    size_t i = 0;
+    for (; i+4<=n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(a+i)),_mm_loadu_si128((const __m128i*)(b+i)));
+        if (int m = _mm_movemask_ps(_mm_castsi128_ps(eq)); m!=0xF)
+            return i+countr_one(unsigned(m));
+    }
+    for (; i<n && a[i]==b[i]; ++i) ;
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t mismatch_avx2(const int* a, const int* b, size_t n)
+{
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(a+i)),_mm256_loadu_si256((const __m256i*)(b+i)));
+        if (int m = _mm256_movemask_ps(_mm256_castsi256_ps(eq)); m!=0xFF)
+            return i+countr_one(unsigned(m));
+    }
+    for (; i<n && a[i]==b[i]; ++i) ;
+    return i;
+}
+
+inline size_t find_sse2(const int* p, size_t n, int v)
+{
+    __m128i x = _mm_set1_epi32(v);
+    size_t i = 0;
+    for (; i+4<=n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p+i)),x);
+        if (int m = _mm_movemask_ps(_mm_castsi128_ps(eq)))
+            return i+countr_zero(unsigned(m));
+    }
+    return i+find_scalar(p+i,n-i,v);
+}
+
+__attribute__((target("avx2"))) inline size_t find_avx2(const int* p, size_t n, int v)
+{
+    __m256i x = _mm256_set1_epi32(v);
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p+i)),x);
+        if (int m = _mm256_movemask_ps(_mm256_castsi256_ps(eq)))
+            return i+countr_zero(unsigned(m));
+    }
+    return i+find_scalar(p+i,n-i,v);
+}
+
+#endif
+
+// the interface: spans in, no pointers or counts for the caller to get wrong
+
+inline void fill(span<int> s, int v)
+{
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return fill_avx2(s.data(),s.size(),v);
+    case Isa::sse2: return fill_sse2(s.data(),s.size(),v);
+#endif
+    default: return fill_scalar(s.data(),s.size(),v);
+    }
+}
+
+inline void copy(span<const int> from, span<int> to)
+{
+    if (to.size()<from.size())
+        throw out_of_range{"bulk::copy: target too small"};
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return copy_avx2(from.data(),to.data(),from.size());
+    case Isa::sse2: return copy_sse2(from.data(),to.data(),from.size());
+#endif
+    default: for (size_t i = 0; i<from.size(); ++i) to[i] = from[i];
+    }
+}
+
+inline long long sum(span<const int> s)
+{
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return sum_avx2(s.data(),s.size());
+    case Isa::sse2: return sum_sse2(s.data(),s.size());
+#endif
+    default: return sum_scalar(s.data(),s.size());
+    }
+}
+
+inline pair<int,int> min_max(span<const int> s) // {INT_MAX,INT_MIN} for an empty span
+{
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return min_max_avx2(s.data(),s.size());
+    case Isa::sse2: return min_max_sse2(s.data(),s.size());
+#endif
+    default: return min_max_scalar(s.data(),s.size(),{INT_MAX,INT_MIN});
+    }
+}
+
+inline size_t mismatch(span<const int> a, span<const int> b) // index of the first difference
+{
+    size_t n = min(a.size(),b.size());
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return mismatch_avx2(a.data(),b.data(),n);
+    case Isa::sse2: return mismatch_sse2(a.data(),b.data(),n);
+#endif
+    default: { size_t i = 0; while (i<n && a[i]==b[i]) ++i; return i; }
+    }
+}
+
+inline bool equal(span<const int> a, span<const int> b)
+{
+    return a.size()==b.size() && mismatch(a,b)==a.size();
+}
+
+inline size_t find(span<const int> s, int v) // index of the first v, or s.size()
+{
+    switch (active) {
+#if defined(__x86_64__)
+    case Isa::avx2: return find_avx2(s.data(),s.size(),v);
+    case Isa::sse2: return find_sse2(s.data(),s.size(),v);
+#endif
+    default: return find_scalar(s.data(),s.size(),v);
+    }
+}
+
+} // namespace bulk
+
+// fs() and fpn() in terms of the kernels
+void fs_bulk(span<int> p)
+{
+    bulk::fill(p,0);
+}
+
+void fpn_bulk(int* p, int n) // still trusts n, like fpn()
+{
+    bulk::fill({p,size_t(n)},0);
+}
+
+// benchmark: the scalar fs() and fpn() against the kernels, and each kernel under each instruction set
+void bench_bulk(size_t n = 1<<20, int reps = 200)
+{
+    vector<int> v(n), w(n);
+    iota(v.begin(),v.end(),0);
+
+    auto time = [reps](const char* label, auto op) {
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r<reps; ++r) op();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/reps << " ns\n";
+    };
+
+    time("fs (range-for):  ",[&] { fs(w); });
+    time("fpn (pointer):   ",[&] { fpn(w.data(),int(n)); });
+    time("fs_bulk:         ",[&] { fs_bulk(w); });
+
+    volatile long long sink = 0;
+    for (auto isa : {bulk::Isa::scalar, bulk::Isa::sse2, bulk::Isa::avx2}) {
+        if (isa>bulk::detect()) break; // don't run what the CPU can't do
+        bulk::active = isa;
+        cout << "isa " << int(isa) << ":\n";
+        time("  fill:    ",[&] { bulk::fill(w,1); });
+        time("  copy:    ",[&] { bulk::copy(v,w); });
+        time("  sum:     ",[&] { sink = sink+bulk::sum(v); });
+        time("  min_max: ",[&] { sink = sink+bulk::min_max(v).first; });
+        time("  equal:   ",[&] { sink = sink+bulk::equal(v,w); });
+        time("  find:    ",[&] { sink = sink+bulk::find(v,-1); });
+    }
+    bulk::active = bulk::detect();
+}
+
+// a span type of our own that can be range checked or not, decided at compile time
+// checked builds report the file and line of the bad subscript and stop
+// unchecked builds get exactly a pointer and a size, like std::span
+
+// the default follows assert(): checked unless NDEBUG is defined; -DNOTES_CHECKED_SPAN=0 or =1 overrides it
+// (the same policy as NOTES_CHECKED_OPTIONAL, below)
+#ifndef NOTES_CHECKED_SPAN
+#ifdef NDEBUG
+#define NOTES_CHECKED_SPAN 0
+#else
+#define NOTES_CHECKED_SPAN 1
+#endif
+#endif
+
+struct Unchecked {
+    using index = size_t;
+    static constexpr void check(bool, const source_location&) {}
+};
+
+struct Checked {
+    // converting a size_t to an index records where the conversion happened, i.e., at the call of s[i]
+    // (operator[] can't have a default argument itself, so that's how we get the caller's location)
+    struct index {
+        size_t i;
+        source_location loc;
+        index(size_t i, source_location loc = source_location::current()) : i{i}, loc{loc} {}
+        operator size_t() const { return i; }
+    };
+
+    static void check(bool ok, const source_location& loc)
+    {
+        if (!ok) {
+            fprintf(stderr,"%s:%u: span range error in %s\n",loc.file_name(),unsigned(loc.line()),loc.function_name());
+            abort();
+        }
+    }
+};
+
+using Default_check = conditional_t<NOTES_CHECKED_SPAN,Checked,Unchecked>;
+
+template<typename T, typename Check = Default_check>
+class Span {
+public:
+    using index = typename Check::index;
+
+    constexpr Span() = default;
+    constexpr Span(T* p, size_t n) : p{p}, n{n} {} // trusted, like std::span{p,n}: nothing to check against
+
+    template<size_t N>
+    constexpr Span(T (&a)[N]) : p{a}, n{N} {} // fs(a): the size comes with the array
+
+    // vector, array, std::span, ...; an rvalue only if it's a borrowed range (e.g., a std::span),
+    // so Span{vector<int>{1,2,3}} doesn't compile instead of dangling
+    template<ranges::contiguous_range R>
+        requires ranges::borrowed_range<R> && is_convertible_v<remove_reference_t<ranges::range_reference_t<R>>(*)[],T(*)[]>
+    constexpr Span(R&& r) : p{ranges::data(r)}, n{ranges::size(r)} {}
+
+    constexpr T& operator[](index i) const
+    {
+        if constexpr (is_same_v<Check,Checked>) Check::check(i<n,i.loc);
+        return p[i];
+    }
+
+    constexpr Span first(size_t k, source_location loc = source_location::current()) const
+    {
+        Check::check(k<=n,loc);
+        return {p,k};
+    }
+
+    constexpr Span subspan(size_t off, size_t k, source_location loc = source_location::current()) const
+    {
+        Check::check(off<=n && k<=n-off,loc);
+        return {p+off,k};
+    }
+
+    constexpr T* data() const { return p; }
+    constexpr size_t size() const { return n; }
+    constexpr bool empty() const { return n==0; }
+    constexpr T* begin() const { return p; } // range-for never goes out of range, so no checking
+    constexpr T* end() const { return p+n; }
+private:
+    T* p = nullptr;
+    size_t n = 0;
+};
+
+// the unchecked version has nothing but the pointer and the size
+static_assert(sizeof(Span<int,Unchecked>)==sizeof(span<int>));
+static_assert(is_trivially_copyable_v<Span<int,Unchecked>>);
+
+void use_checked(int x)
+{
+    int a[100];
+    Span<int,Checked> s {a};
+    s[99] = 0; // OK
+    s[100] = 0; // checked build: "main.cpp:<line>: span range error in ..." and abort
+    auto s2 = s.subspan(10,100); // caught: only 90 elements left after 10
+    auto s3 = Span<int,Checked>{a,size_t(x)}; // still suspect: a (pointer,count) pair can't be checked
+    s2[0] = s3[0];
+}
+
+// the same size isn't the same code; for that, compare the generated code for the same loop over each:
+// g++ 12 -O2 -S (x86-64) gives sum_std, sum_unchecked, and also sum_checked the same 9-instruction loop
+// (in sum_checked, the loop condition i<s.size() already proves i<n, so the compiler removes the check)
+// a loop whose index doesn't come from the size, like s[f(i)], keeps its checks: that's the overhead checking costs
+
+// benchmark: the same loop over std::span, the unchecked Span, and the checked Span
+
+long long sum_std(span<const int> s)
+{
+    long long res = 0;
+    for (size_t i = 0; i<s.size(); ++i) res += s[i];
+    return res;
+}
+
+long long sum_unchecked(Span<const int,Unchecked> s)
+{
+    long long res = 0;
+    for (size_t i = 0; i<s.size(); ++i) res += s[i];
+    return res;
+}
+
+long long sum_checked(Span<const int,Checked> s)
+{
+    long long res = 0;
+    for (size_t i = 0; i<s.size(); ++i) res += s[i];
+    return res;
+}
+
+void bench_span(size_t n = 1<<20, int reps = 200)
+{
+    vector<int> v(n,1);
+    auto time = [&](const char* label, auto sum) {
+        long long total = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r<reps; ++r) total += sum(v);
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/reps << " ns (" << total << ")\n";
+    };
+    time("std::span:          ",sum_std);
+    time("Span<Unchecked>:    ",sum_unchecked);
+    time("Span<Checked>:      ",sum_checked);
+}
+
+//15.3 Containers
+// std provides contaienrs that don't fit perfectly in the STL framework
+// examples: built in arrays, array, string
+
+// 15.3.1 array
+// array is a fixed-size sequence of elements where the number of elements is specified at compile time
+
+// an array can thus be allocated with its elements on the stack, in an object, or in static storage
+// these elements are allocated in the scope where array is defined
+
+// array is first understood as a built-in array with its size firmly attached, without implicit conversions to ptr types, with few qol functions
+
+// there is no space or time overhead when using an array compared to using a built-in array
+
+// array doesn't follow the "handle to elements" model of Stl containers
+
+// array directly contains its elements
+
+// it's just a safer version of a built-in array
+
+// this implies that an array can and must be initialized by an initializer list
+
+std::array<int,3> a1 = {1,2,3};
+// number of elements in the initializer must be equal to or less than the number of elements specified for the array
+
+// the element count is required and we need to state the type of the elements
+
+void f(int n)
+{
+    std::array<int> a0 = {1,2,3}; // error size not specified
+    std::array<string,n> a1 = {"John's", "Queens' "}; // error: size not a constant expression
+    std::array<string,0> a2; // error: size must be positive
+    std::array<2> a3 = {"John's", "Queens' "}; // error: element type not stated
+}
+
+// when you need the element count to be variable, use vector. std::array has a fixed element count
+
+// std::array can be passed to a C-style function that expects a pointer
+
+void f(int * p, int sz); // C-style inferface
+
+void g()
+{
+    std::array<int, 10> a;
+
+    f(a, a.size()); // error: no conversion
+    f(a.data(), a.size()); // C-style use
+
+    auto p = find(a, 777); //C++/STL-style use (a range is passed)
+}
+
+// why use array instead of vector
+// array is less flexible than vector, and thus simpler
+// sometimes, there is an advantage to accessing elements on the stack, instead of allocating them on the free store, accessing them indirectly through a vector, and then deallocating them
+
+// disadvantage: stack is limited, especially on embedded systems, and stack overflow is nasty
+
+// some application areas, like safety-critical real-time constrol, ban free-store allocation
+// use of delete and can lead to fragmentation or memory exhaustion
+
+// why use std:: array instead of built in array?
+// std::array knows its size and can be copied with =
+std::array<int,3> a1 = {1,2,3};
+
+auto a2 = a1; // copy
+
+a2[1] = 5;
+a1 = a2; // assign
+
+// std::arrays prevents nasty and unexpected conversions to ptrs
+
+// example involving a class hiearchy
+void h()
+{
+    Circle a1[10];
+    std::array<Circle,10> s2;
+    // ..
+    Shape* p1 = a1; // Ok: disaster waiting to happen
+    Shape* p2 = a2; // error:no conversion of array<Circle,10> to Shape*(Good!)
+    p1[3].draw(); // disaster
+}
+
+// disaster comment assumes that sizeof(Shape)<sizeof(Circle), so subscripting Circle[] through a Shape* gives a wrong offset
+// all standard containers provide this advantage over built in arrays
+
+// array avoids the free store, but its size is fixed
+// often we know an upper bound but not the exact number of elements, and vector allocates even for two or three of them
+
+// static_vector<T,N>: a vector with at most N elements, kept in an array inside the object
+// small_vector<T,N>: keeps up to N elements inside the object and moves them to the free store if it grows beyond that
+
+// both keep their elements in a std::array, so T must be default constructible (and movable)
+// that's what lets everything be constexpr in C++20 without placement new tricks
+// like array, neither converts to a T*, so static_vector<Circle,10> can't turn into a Shape* by accident
+
+template<typename T, size_t N>
+    requires default_initializable<T> && movable<T>
+class static_vector {
+public:
+    constexpr static_vector() = default;
+    constexpr static_vector(initializer_list<T> lst)
+    {
+        for (const T& x : lst)
+            push_back(x);
+    }
+
+    constexpr size_t size() const { return sz; }
+    constexpr static size_t capacity() { return N; }
+    constexpr bool empty() const { return sz==0; }
+
+    constexpr T& operator[](size_t i) { return elem[i]; }
+    constexpr const T& operator[](size_t i) const { return elem[i]; }
+    constexpr T& back() { return elem[sz-1]; }
+
+    constexpr T* data() { return elem.data(); } // explicit, never implicit
+    constexpr const T* data() const { return elem.data(); }
+    constexpr T* begin() { return elem.data(); }
+    constexpr T* end() { return elem.data()+sz; }
+    constexpr const T* begin() const { return elem.data(); }
+    constexpr const T* end() const { return elem.data()+sz; }
+
+    template<typename... Args>
+    constexpr T& emplace_back(Args&&... args)
+    {
+        if (sz==N)
+            throw length_error{"static_vector: full"};
+        elem[sz] = T(forward<Args>(args)...);
+        return elem[sz++];
+    }
+    constexpr void push_back(const T& x) { emplace_back(x); }
+    constexpr void push_back(T&& x) { emplace_back(move(x)); }
+
+    constexpr void pop_back() { elem[--sz] = T{}; } // release whatever the element holds now, not when the vector dies
+    constexpr void clear() { while (sz) pop_back(); }
+private:
+    array<T,N> elem {};
+    size_t sz = 0;
+};
+
+template<typename T, size_t N>
+    requires default_initializable<T> && movable<T>
+class small_vector {
+public:
+    constexpr small_vector() = default;
+    constexpr small_vector(initializer_list<T> lst)
+    {
+        for (const T& x : lst)
+            push_back(x);
+    }
+
+    constexpr small_vector(const small_vector& a) { for (const T& x : a) push_back(x); }
+    constexpr small_vector& operator=(const small_vector& a)
+    {
+        if (this!=&a) {
+            clear();
+            for (const T& x : a)
+                push_back(x);
+        }
+        return *this;
+    }
+
+    // noexcept when T's moves are, so that a vector<small_vector> moves its elements when it reallocates instead of copying them
+    // (moving inline elements never grows: the target's capacity is at least N)
+    static constexpr bool nothrow_move = is_nothrow_move_constructible_v<T> && is_nothrow_move_assignable_v<T>
+        && is_nothrow_default_constructible_v<T>; // clear() assigns T{}
+
+    constexpr small_vector(small_vector&& a) noexcept(nothrow_move) { *this = move(a); }
+    constexpr small_vector& operator=(small_vector&& a) noexcept(nothrow_move)
+    {
+        if (this!=&a) {
+            clear();
+            if (a.heap) { // steal the free store elements
+                delete[] heap;
+                heap = exchange(a.heap,nullptr);
+                cap = exchange(a.cap,N);
+                sz = exchange(a.sz,0);
+            }
+            else {
+                for (T& x : a)
+                    push_back(move(x));
+                a.clear();
+            }
+        }
+        return *this;
+    }
+
+    constexpr ~small_vector() { delete[] heap; }
+
+    constexpr size_t size() const { return sz; }
+    constexpr size_t capacity() const { return cap; }
+    constexpr bool empty() const { return sz==0; }
+    constexpr bool is_inline() const { return heap==nullptr; }
+
+    constexpr T* data() { return heap ? heap : buf.data(); }
+    constexpr const T* data() const { return heap ? heap : buf.data(); }
+    constexpr T& operator[](size_t i) { return data()[i]; }
+    constexpr const T& operator[](size_t i) const { return data()[i]; }
+    constexpr T& back() { return data()[sz-1]; }
+
+    constexpr T* begin() { return data(); }
+    constexpr T* end() { return data()+sz; }
+    constexpr const T* begin() const { return data(); }
+    constexpr const T* end() const { return data()+sz; }
+
+    template<typename... Args>
+    constexpr T& emplace_back(Args&&... args)
+    {
+        T x(forward<Args>(args)...); // args might refer to an element we are about to move
+        if (sz==cap)
+            grow(cap ? 2*cap : 1);
+        data()[sz] = move(x);
+        return data()[sz++];
+    }
+    constexpr void push_back(const T& x) { emplace_back(x); }
+    constexpr void push_back(T&& x) { emplace_back(move(x)); }
+
+    constexpr void pop_back() { data()[--sz] = T{}; }
+    constexpr void clear() { while (sz) pop_back(); }
+private:
+    constexpr void grow(size_t n)
+    {
+        T* p = new T[n];
+        for (size_t i = 0; i<sz; ++i)
+            p[i] = move(data()[i]);
+        if (heap)
+            delete[] heap;
+        else
+            for (T& x : buf) x = T{}; // the inline elements are empty from now on
+        heap = p;
+        cap = n;
+    }
+
+    array<T,N> buf {};
+    T* heap = nullptr;
+    size_t sz = 0;
+    size_t cap = N;
+};
+
+// everything works at compile time
+constexpr int sum_squares(int n)
+{
+    static_vector<int,16> sv;
+    small_vector<int,4> smv; // grows onto the free store after 4 elements
+    for (int i = 0; i<n; ++i) {
+        sv.push_back(i*i);
+        smv.push_back(i*i);
+    }
+    int s = 0;
+    for (int x : sv) s += x;
+    for (int x : smv) s -= x;
+    return s==0 ? accumulate(sv.begin(),sv.end(),0) : -1;
+}
+
+static_assert(sum_squares(10)==285);
+static_assert(is_nothrow_move_constructible_v<small_vector<string,4>>);
+
+void h2()
+{
+    static_vector<Circle,10> a2;
+    // ..
+    Shape* p2 = a2; // error: no conversion of static_vector<Circle,10> to Shape* (Good!)
+}
+
+// benchmark: push n elements, iterate over them, destroy the container, for n from 0 to 64
+template<typename Vec>
+double ns_per_round(int n, int reps = 100'000)
+{
+    long long sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r<reps; ++r) {
+        Vec v;
+        for (int i = 0; i<n; ++i)
+            v.push_back(i);
+        for (int x : v)
+            sink += x;
+    }
+    chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+    volatile long long keep = sink;
+    (void)keep;
+    return d.count()/reps;
+}
+
+void bench_small_vectors()
+{
+    cout << "n\tvector\tstatic_vector<64>\tsmall_vector<16>\n";
+    for (int n : {0, 1, 2, 4, 8, 16, 32, 64})
+        cout << n << '\t' << ns_per_round<vector<int>>(n)
+             << '\t' << ns_per_round<static_vector<int,64>>(n)
+             << '\t' << ns_per_round<small_vector<int,16>>(n) << '\n';
+}
+
+// 15.3.2 bitset
+
+// aspects of the system, like state of the input stream, are often represented as a set of flags indicating binary conditions
+// such as good/bad, true/false and on/off
 
 // C++ supports the notion of small sets of flags efficiently through bitwise operations on integers
 
-// bitset<N> generalizes this notion by providing operations on a sequence of N bits, where N is known at compile time. 
-// for sets of bits that don't fit into a long long int (64 bits), bitset is much more convienent that using integers directly
+// bitset<N> generalizes this notion by providing operations on a sequence of N bits, where N is known at compile time. 
+// for sets of bits that don't fit into a long long int (64 bits), bitset is much more convienent that using integers directly
+
+// for smaller sets, bitset is usually optimized
+
+// sets or enumerations let you name the bits
+
+// a bitset can be initialized with an int or string
+
+bitset<9> bs1 {"110001111"};
+bitset<9> bs2 {0b1'1000'1111}; // binary literal using digit separators 
+
+// bitwise operators left and right shift can be applied
+
+bitset<9> bs3 = ~bs1; // complement: bs3=="001110000"
+bitset<9> bs4 = bs1&bs3; // all zeros
+bitset<9> bs5 = bs1<<2; // shift left: bs5 = "000111100"
+
+// shift operatos shift in zeros
+
+// operations to_ullong and to_string() provide the inverse operations to the constructors
+// for example, we can write out the binary representation of an int
+
+void binary(int i)
+{
+    bitset<8*sizeof(int)> b = i; // assume 8-bit byte 
+    cout << b.to_string() << '\n'; // write out the bits of i
+}
+
+void binary2(int i)
+{
+    bitset<8>sizeof(int)> b = i; // assume 8-bit byte
+    cout << b << '\n'; // write out the bits of i
+}
+
+// binary() allocates a string for to_string() and then pushes it through cout's locale and formatting machinery
+// that's fine for an example, but not for dumping millions of bit patterns
+
+// the alternative: write the digits straight into a buffer the caller provides, like to_chars does
+// to_chars can do base 2, 8, and 16, but it drops leading zeros, and for bit patterns we want all the bits
+
+// the results are like to_chars: {end of the output, errc{}} or {last, errc::value_too_large} if the buffer is too small
+
+// binary: a table with the 8 characters for each byte value, so we copy 8 digits at a time
+constexpr auto bin_table = [] {
+    array<array<char,8>,256> t {};
+    for (int v = 0; v<256; ++v)
+        for (int b = 0; b<8; ++b)
+            t[v][b] = (v>>(7-b))&1 ? '1' : '0';
+    return t;
+}();
+
+constexpr char hex_digits[] = "0123456789abcdef";
+
+// signed values are written as their bit pattern, like bitset<8*sizeof(int)> b = i does
+template<integral T>
+to_chars_result to_bin(char* first, char* last, T v)
+{
+    make_unsigned_t<T> x = v;
+    constexpr size_t n = 8*sizeof(T);
+    if (size_t(last-first)<n)
+        return {last,errc::value_too_large};
+    for (size_t i = 0; i<sizeof(T); ++i) // most significant byte first
+        memcpy(first+8*i,bin_table[(x>>(8*(sizeof(T)-1-i)))&0xFF].data(),8);
+    return {first+n,errc{}};
+}
+
+template<integral T>
+to_chars_result to_hex(char* first, char* last, T v)
+{
+    make_unsigned_t<T> x = v;
+    constexpr size_t n = 2*sizeof(T);
+    if (size_t(last-first)<n)
+        return {last,errc::value_too_large};
+    for (size_t i = 0; i<n; ++i)
+        first[i] = hex_digits[(x>>(4*(n-1-i)))&0xF];
+    return {first+n,errc{}};
+}
+
+template<integral T>
+to_chars_result to_oct(char* first, char* last, T v)
+{
+    make_unsigned_t<T> x = v;
+    constexpr size_t n = (8*sizeof(T)+2)/3;
+    if (size_t(last-first)<n)
+        return {last,errc::value_too_large};
+    for (size_t i = 0; i<n; ++i)
+        first[i] = '0'+((x>>(3*(n-1-i)))&7);
+    return {first+n,errc{}};
+}
+
+// a bitset doesn't give access to its words, but to_ullong() gives the lowest 64 bits,
+// so we take 64 bits at a time from the right end and write each word through the table like an integer
+template<size_t N>
+to_chars_result to_bin(char* first, char* last, const bitset<N>& b) // same digits as b.to_string()
+{
+    if (size_t(last-first)<N)
+        return {last,errc::value_too_large};
+    const bitset<N> word_mask {~0ull}; // the lowest 64 bits (or all N, if N<64)
+    bitset<N> rest = b;
+    char* p = first+N; // fill backwards, one word at a time
+    for (size_t done = 0; done<N; done += 64) {
+        char digits[64];
+        to_bin(digits,digits+64,(rest&word_mask).to_ullong());
+        rest >>= 64;
+        size_t k = min<size_t>(64,N-done); // the digits of this word that belong to the bitset
+        p -= k;
+        memcpy(p,digits+64-k,k);
+    }
+    return {first+N,errc{}};
+}
+
+void binary3(int i)
+{
+    char buf[8*sizeof(int)+1];
+    auto [end,ec] = to_bin(buf,buf+sizeof(buf),i); // can't fail: buf is big enough
+    *end++ = '\n';
+    fwrite(buf,1,end-buf,stdout); // one write, no allocation, no locale
+}
+
+// for many values, collect the output in one buffer and write it all at once
+
+class Bits_out {
+public:
+    explicit Bits_out(FILE* f = stdout) : f{f} {}
+    ~Bits_out() { flush(); }
+
+    template<typename T>
+    Bits_out& bin(const T& x) { return put([&](char* p, char* e) { return to_bin(p,e,x); }); }
+    template<typename T>
+    Bits_out& hex(T x) { return put([&](char* p, char* e) { return to_hex(p,e,x); }); }
+    template<typename T>
+    Bits_out& oct(T x) { return put([&](char* p, char* e) { return to_oct(p,e,x); }); }
+
+    Bits_out& operator<<(char c)
+    {
+        if (pos==buf.size()) flush();
+        buf[pos++] = c;
+        return *this;
+    }
+
+    void flush()
+    {
+        fwrite(buf.data(),1,pos,f);
+        pos = 0;
+    }
+private:
+    template<typename Write>
+    Bits_out& put(Write write)
+    {
+        auto r = write(buf.data()+pos,buf.data()+buf.size());
+        if (r.ec!=errc{}) { // out of space: empty the buffer and try again
+            flush();
+            r = write(buf.data(),buf.data()+buf.size());
+            if (r.ec!=errc{})
+                throw length_error{"Bits_out: value too long for the buffer"};
+        }
+        pos = r.ptr-buf.data();
+        return *this;
+    }
+
+    FILE* f;
+    array<char,1<<16> buf;
+    size_t pos = 0;
+};
+
+// std::format support: format("{:b}",as_bits(x)) writes all the bits, {:x} and {:o} all the hex and octal digits (integers only)
+// (std::format's own {:b} drops the leading zeros, and it can't format a bitset)
+
+template<typename T>
+struct As_bits {
+    T value;
+};
+
+template<typename T>
+As_bits<T> as_bits(const T& x) { return {x}; }
+
+#if defined(__cpp_lib_format)
+template<typename T>
+struct std::formatter<As_bits<T>> {
+    char base = 'b';
+
+    constexpr auto parse(format_parse_context& ctx)
+    {
+        auto p = ctx.begin();
+        if (p!=ctx.end() && (*p=='b' || *p=='x' || *p=='o'))
+            base = *p++;
+        if (!integral<T> && base!='b')
+            throw format_error{"as_bits: a bitset only has a binary form, {:b}"};
+        if (p!=ctx.end() && *p!='}')
+            throw format_error{"as_bits: expected b, x, or o"};
+        return p;
+    }
+
+    auto format(const As_bits<T>& b, format_context& ctx) const
+    {
+        char buf[1024];
+        auto r = to_bin(buf,buf+sizeof(buf),b.value); // parse() allowed only b for a bitset
+        if constexpr (integral<T>) {
+            if (base=='x') r = to_hex(buf,buf+sizeof(buf),b.value);
+            if (base=='o') r = to_oct(buf,buf+sizeof(buf),b.value);
+        }
+        if (r.ec!=errc{})
+            throw format_error{"as_bits: value too long"};
+        return ranges::copy(buf,r.ptr,ctx.out()).out;
+    }
+};
+#endif
+
+// benchmark: n values through binary() (to_string() + cout) and through Bits_out
+void bench_binary(int n = 1'000'000)
+{
+    auto time = [](auto op) {
+        auto t0 = chrono::steady_clock::now();
+        op();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        return d.count();
+    };
+    // the output goes to /dev/null so we measure the formatting, not the terminal
+    ofstream null_stream {"/dev/null"};
+    FILE* null = fopen("/dev/null","w");
+    if (!null || !null_stream) {
+        if (null) fclose(null);
+        throw No_file{};
+    }
+    auto old = cout.rdbuf();
+    cout.rdbuf(null_stream.rdbuf());
+
+    double t1 = time([n] { for (int i = 0; i<n; ++i) binary(i); });
+    double t2 = time([n,null] { Bits_out out {null}; for (int i = 0; i<n; ++i) out.bin(i) << '\n'; });
+
+    cout.rdbuf(old);
+    fclose(null);
+    cout << "to_string + cout: " << t1/n << " ns per value\n";
+    cout << "Bits_out:         " << t2/n << " ns per value\n";
+}
+
+// bitset offers functions for using and manipulating sets of bits
+
+// bitset's size is a template argument, so it must be known at compile time
+// for sets of flags sized at run time (and millions of bits long), we need a bitset that keeps its bits on the free store
+
+// Bits offers the same operators as bitset and works a 64-bit word at a time
+// &, |, and ^ over whole sets dispatch on bulk::active like the span kernels: AVX2 (256 bits per instruction) or SSE2 (128)
+// bits are numbered like bitset: bit 0 is the rightmost character in to_string()
+
+class Bits {
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit Bits(size_t n = 0, bool value = false) : n{n}, w((n+63)/64,value ? ~uint64_t{0} : 0) { trim(); }
+
+    explicit Bits(string_view s) : Bits(s.size()) // "110001111", like bitset<9>{"110001111"}
+    {
+        for (size_t i = 0; i<n; ++i) {
+            char c = s[n-1-i];
+            if (c!='0' && c!='1')
+                throw invalid_argument{"Bits: not a binary digit"};
+            if (c=='1') set(i);
+        }
+    }
+
+    size_t size() const { return n; }
+
+    bool test(size_t i) const { return w[i/64]>>(i%64)&1; }
+    void set(size_t i) { w[i/64] |= uint64_t{1}<<(i%64); }
+    void reset(size_t i) { w[i/64] &= ~(uint64_t{1}<<(i%64)); }
+    void flip(size_t i) { w[i/64] ^= uint64_t{1}<<(i%64); }
+
+    size_t count() const // popcount: one instruction per word with -mpopcnt (or -march=native)
+    {
+        size_t c = 0;
+        for (uint64_t x : w) c += popcount(x);
+        return c;
+    }
+
+    size_t find_first() const { return find_next(0); }
+
+    size_t find_next(size_t pos) const // the first set bit at or after pos, or npos
+    {
+        if (pos>=n) return npos;
+        size_t i = pos/64;
+        uint64_t x = w[i]&(~uint64_t{0}<<(pos%64)); // ignore the bits before pos
+        while (x==0) {
+            if (++i==w.size()) return npos;
+            x = w[i];
+        }
+        return i*64+countr_zero(x);
+    }
+
+    Bits& operator&=(const Bits& b) { combine(b,Op::and_); return *this; }
+    Bits& operator|=(const Bits& b) { combine(b,Op::or_); return *this; }
+    Bits& operator^=(const Bits& b) { combine(b,Op::xor_); return *this; }
+
+    Bits operator~() const
+    {
+        Bits r = *this;
+        for (uint64_t& x : r.w) x = ~x;
+        r.trim();
+        return r;
+    }
+
+    Bits operator<<(size_t k) const // shifts in zeros, like bitset
+    {
+        Bits r(n);
+        size_t words = k/64, bits = k%64;
+        for (size_t i = w.size(); i-->words;) {
+            uint64_t x = w[i-words]<<bits;
+            if (bits && i-words>0) x |= w[i-words-1]>>(64-bits);
+            r.w[i] = x;
+        }
+        r.trim();
+        return r;
+    }
+
+    Bits operator>>(size_t k) const
+    {
+        Bits r(n);
+        size_t words = k/64, bits = k%64;
+        for (size_t i = 0; i+words<w.size(); ++i) {
+            uint64_t x = w[i+words]>>bits;
+            if (bits && i+words+1<w.size()) x |= w[i+words+1]<<(64-bits);
+            r.w[i] = x;
+        }
+        return r;
+    }
+
+    bool operator==(const Bits&) const = default;
+
+    string to_string() const
+    {
+        string s(n,'0');
+        for (size_t i = find_first(); i!=npos; i = find_next(i+1))
+            s[n-1-i] = '1';
+        return s;
+    }
+
+    span<const uint64_t> words() const { return w; } // for Rank_select and other bulk algorithms
+
+    enum class Op { and_, or_, xor_ };
+private:
+    void combine(const Bits& b, Op op);
+
+    void trim() // keep the bits beyond n zero, so count(), ==, and find_next() needn't care about them
+    {
+        if (n%64) w.back() &= (uint64_t{1}<<(n%64))-1;
+    }
+
+    size_t n;
+    vector<uint64_t> w;
+};
+
+Bits operator&(Bits a, const Bits& b) { return a &= b; }
+Bits operator|(Bits a, const Bits& b) { return a |= b; }
+Bits operator^(Bits a, const Bits& b) { return a ^= b; }
+
+ostream& operator<<(ostream& os, const Bits& b) { return os << b.to_string(); }
 
-// for smaller sets, bitset is usually optimized
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) size_t combine_avx2(uint64_t* a, const uint64_t* b, size_t n, Bits::Op op)
+{
+    size_t i = 0;
+    for (; i+4<=n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+        switch (op) { // the compiler hoists this out of the loop
+        case Bits::Op::and_: x = _mm256_and_si256(x,y); break;
+        case Bits::Op::or_: x = _mm256_or_si256(x,y); break;
+        case Bits::Op::xor_: x = _mm256_xor_si256(x,y); break;
+        }
+        _mm256_storeu_si256((__m256i*)(a+i),x);
+    }
+    return i; // the caller does the rest
+}
 
-// sets or enumerations let you name the bits
+size_t combine_sse2(uint64_t* a, const uint64_t* b, size_t n, Bits::Op op)
+{
+    size_t i = 0;
+    for (; i+2<=n; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+        switch (op) {
+        case Bits::Op::and_: x = _mm_and_si128(x,y); break;
+        case Bits::Op::or_: x = _mm_or_si128(x,y); break;
+        case Bits::Op::xor_: x = _mm_xor_si128(x,y); break;
+        }
+        _mm_storeu_si128((__m128i*)(a+i),x);
+    }
+    return i;
+}
+#endif
 
-// a bitset can be initialized with an int or string
+void Bits::combine(const Bits& b, Op op)
+{
+    if (b.n!=n)
+        throw invalid_argument{"Bits: size mismatch"};
+    uint64_t* p = w.data();
+    const uint64_t* q = b.w.data();
+    const size_t m = w.size();
+    size_t i = 0;
+#if defined(__x86_64__)
+    switch (bulk::active) {
+    case bulk::Isa::avx2: i = combine_avx2(p,q,m,op); break;
+    case bulk::Isa::sse2: i = combine_sse2(p,q,m,op); break;
+    default: break;
+    }
+#endif
+    // the rest (all of it for Isa::scalar), word-parallel: 64 bits per operation
+    switch (op) {
+    case Op::and_: for (; i<m; ++i) p[i] &= q[i]; break;
+    case Op::or_: for (; i<m; ++i) p[i] |= q[i]; break;
+    case Op::xor_: for (; i<m; ++i) p[i] ^= q[i]; break;
+    }
+}
 
-bitset<9> bs1 {"110001111"};
-bitset<9> bs2 {0b1'1000'1111}; // binary literal using digit separators 
+Bits bb1 {"110001111"};
+Bits bb3 = ~bb1; // bb3=="001110000", like bs3
+Bits bb5 = bb1<<2; // "000111100", like bs5
 
-// bitwise operators left and right shift can be applied
+// rank(i): how many bits before i are set
+// select(k): where is the k-th set bit (counting from 0)
+// both are common in compressed indexes; with a small table of counts, they don't need to scan the whole set
 
-bitset<9> bs3 = ~bs1; // complement: bs3=="001110000"
-bitset<9> bs4 = bs1&bs3; // all zeros
-bitset<9> bs5 = bs1<<2; // shift left: bs5 = "000111100"
+// the table holds the number of set bits before each block of 8 words (512 bits): 1/8 extra space
+// rank() is one table lookup plus at most 8 popcounts
+// select() is a binary search in the table plus at most 8 popcounts and a scan of one word
+
+class Rank_select {
+public:
+    explicit Rank_select(const Bits& b) : w{b.words()}, n{b.size()}
+    {
+        size_t c = 0;
+        for (size_t i = 0; i<w.size(); ++i) {
+            if (i%8==0) blocks.push_back(c);
+            c += popcount(w[i]);
+        }
+        blocks.push_back(c); // total
+    }
+
+    size_t rank(size_t i) const // the number of set bits in [0:i)
+    {
+        size_t blk = i/512;
+        size_t r = blocks[blk];
+        for (size_t j = blk*8; j<i/64; ++j) r += popcount(w[j]);
+        if (i%64) r += popcount(w[i/64]&((uint64_t{1}<<(i%64))-1));
+        return r;
+    }
+
+    size_t select(size_t k) const // the position of the k-th set bit, or Bits::npos
+    {
+        if (k>=blocks.back()) return Bits::npos;
+        size_t blk = upper_bound(blocks.begin(),blocks.end(),k)-blocks.begin()-1; // the last block starting at or before k
+        k -= blocks[blk];
+        size_t j = blk*8;
+        for (size_t c; (c = popcount(w[j]))<=k; ++j) k -= c;
+        uint64_t x = w[j];
+        for (; k; --k) x &= x-1; // drop the k lowest set bits
+        return j*64+countr_zero(x);
+    }
+
+    size_t size() const { return n; }
+private:
+    span<const uint64_t> w; // the Bits must outlive the Rank_select and not change
+    size_t n;
+    vector<size_t> blocks;
+};
+
+// benchmark: &, count, and find-next over n bits with Bits, vector<bool>, and a vector of bitset<4096> chunks
+void bench_bits(size_t n = 1<<24)
+{
+    auto time = [](const char* label, auto op) {
+        auto t0 = chrono::steady_clock::now();
+        auto res = op();
+        chrono::duration<double,micro> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count() << " us (" << res << ")\n";
+    };
+
+    Bits a(n), b(n);
+    vector<bool> va(n), vb(n);
+    constexpr size_t chunk = 4096;
+    vector<bitset<chunk>> ca(n/chunk), cb(n/chunk);
+    for (size_t i = 0; i<n; i += 3) { a.set(i); va[i] = true; ca[i/chunk].set(i%chunk); }
+    for (size_t i = 0; i<n; i += 5) { b.set(i); vb[i] = true; cb[i/chunk].set(i%chunk); }
+
+    time("Bits &=:          ",[&] { a &= b; return a.count(); });
+    time("vector<bool> &:   ",[&] { for (size_t i = 0; i<n; ++i) va[i] = va[i] && vb[i]; return count(va.begin(),va.end(),true); });
+    time("bitset chunks &=: ",[&] { size_t c = 0; for (size_t i = 0; i<ca.size(); ++i) c += (ca[i] &= cb[i]).count(); return c; });
+
+    time("Bits find_next:   ",[&] { size_t c = 0; for (size_t i = a.find_first(); i!=Bits::npos; i = a.find_next(i+1)) ++c; return c; });
+    time("vector<bool> scan:",[&] { size_t c = 0; for (size_t i = 0; i<n; ++i) c += va[i]; return c; });
+
+    Rank_select rs {a};
+    const size_t ones = a.count();
+    time("1M rank+select:   ",[&] { size_t c = 0; for (size_t i = 0; i<1'000'000; ++i) c += rs.select(rs.rank((i*7919)%n)%ones); return c; });
+}
+
+// 15.3.3 pair
+
+// it's common for a function to return two values
+// simplest and often best way is to define a struct for the purpose
+// for example, we can return a value and a success indicator
+
+struct My_res {
+    Entry* ptr;
+    Error_code err;
+}
+
+My_res complex_search(vector<Entry>& v, const string& s)
+{
+    Entry* found = nullptr;
+    Error_code err = Error_code::found;
+    // .. search for s in v ..
+    return {found,err};
+}
+
+void user(const string& s)
+{
+    My_res r = complex_search(entry_table,s); // search entry_table
+    if (r.err != Error_code::good)
+    {
+        // ... handle error ...
+    }
+    // use ptr
+}
+
+// encoding pair was an end indicator or nullptr might be more elegant, but that can only express one kind of failure
+
+// often, we want to return two seperate values
+// defining a named struct for each pair of values often works well and is readable if the names of the pair of values structs and their members are well chosen
+// std:: pair provides support for pair of value use cases
+
+std::pair<Entry*, Error_code> complex_search(std::vector<Entry>& v, const std::string& s)
+{
+    Entry* found = nullptr;
+    Error_code err = Error_code::found;
+    // ... search for s in v ...
+    return {found, err};
+}
+
+void user(const string& s)
+{
+    auto r = complex_search(entry_table,s); // search entry_table
+    if (r.second != Error_code::good) {
+        // .. handle error...
+    }
+
+    // use r.first
+}
+
+// members of pair are named first and second
+// that makes sense from an implementers point of view, but in application code we may want to use our own names
+// structured binding can be used to deal with that
+
+void user(const string& s)
+{
+    auto [ptr,success] complex_search(entry_table,s); // search entry_table
+    if (success != Error_code::good)
+    {
+        // ... handle error
+    }
+    // ... use ptr
+}
+
+// complex_search() looks at every entry until it finds s: O(n) per search
+// for big tables that dominates everything else, so we keep an index next to the table
+
+// assume Entry has a string member name, which is what we search for,
+// and that Error_code has good and not_found
+
+// Entry_index keeps two indexes over the same vector<Entry>:
+// a hash table for exact lookups (open addressing, linear probing: one flat array, no node per entry)
+// a sorted array of positions for prefix queries
+// both hold positions in the vector, not pointers, so adding entries (and reallocating the vector) doesn't invalidate them
+
+class Entry_index {
+public:
+    explicit Entry_index(vector<Entry>& v) : table{v}
+    {
+        rehash(max<size_t>(16,bit_ceil(2*v.size())));
+        for (size_t i = 0; i<v.size(); ++i)
+            insert_hash(i);
+        by_name.resize(v.size());
+        iota(by_name.begin(),by_name.end(),uint32_t{0});
+        stable_sort(by_name.begin(),by_name.end(),[this](uint32_t a, uint32_t b) { return name(a)<name(b); });
+    }
+
+    void add(Entry e) // add to the table and to both indexes
+    {
+        table.push_back(move(e));
+        if (2*(count+1)>slots.size()) // keep the hash table at most half full
+            rehash(2*slots.size());
+        insert_hash(table.size()-1);
+        pending.push_back(uint32_t(table.size()-1)); // sorted into by_name by the next prefix query
+    }
+
+    My_res find(string_view s) { return find(s,hash_of(s)); } // same contract as complex_search()
+
+    // for batches: hash all the queries first, and prefetch their slots before probing
+    static size_t hash_of(string_view s) { return hash<string_view>{}(s); }
+    void prefetch(size_t h) const { __builtin_prefetch(&slots[h&mask]); } // gcc/clang
+
+    My_res find(string_view s, size_t h) // h must be hash_of(s)
+    {
+        for (size_t i = h&mask;; i = (i+1)&mask) {
+            const Slot& x = slots[i];
+            if (x.pos==empty) return {nullptr,Error_code::not_found};
+            if (x.hash==h && name(x.pos)==s) return {&table[x.pos],Error_code::good};
+        }
+    }
+
+    vector<Entry*> with_prefix(string_view p) // all entries whose name starts with p, in name order
+    {
+        merge_pending();
+        auto first = lower_bound(by_name.begin(),by_name.end(),p,[this](uint32_t a, string_view s) { return name(a)<s; });
+        vector<Entry*> res;
+        for (auto q = first; q!=by_name.end() && name(*q).starts_with(p); ++q)
+            res.push_back(&table[*q]);
+        return res;
+    }
+private:
+    static constexpr uint32_t empty = uint32_t(-1);
+    struct Slot {
+        size_t hash; // kept so that most misses don't need to touch the entry at all
+        uint32_t pos = empty; // 4G entries are enough, and the slot stays small
+    };
+
+    string_view name(uint32_t i) const { return table[i].name; }
+
+    void insert_hash(size_t pos)
+    {
+        string_view s = name(pos);
+        size_t h = hash_of(s);
+        size_t i = h&mask;
+        for (; slots[i].pos!=empty; i = (i+1)&mask)
+            if (slots[i].hash==h && name(slots[i].pos)==s) return; // keep the first, like a linear search finds it
+        slots[i] = {h,uint32_t(pos)};
+        ++count;
+    }
+
+    void rehash(size_t n) // n must be a power of 2
+    {
+        vector<Slot> old = exchange(slots,vector<Slot>(n));
+        mask = n-1;
+        count = 0;
+        for (const Slot& x : old)
+            if (x.pos!=empty) {
+                size_t i = x.hash&mask;
+                while (slots[i].pos!=empty) i = (i+1)&mask;
+                slots[i] = x;
+                ++count;
+            }
+    }
+
+    void merge_pending() // sort the new entries and merge them in: O(n + k log k), not a full re-sort
+    {
+        if (pending.empty()) return;
+        auto less = [this](uint32_t a, uint32_t b) { return name(a)<name(b); };
+        stable_sort(pending.begin(),pending.end(),less);
+        size_t mid = by_name.size();
+        by_name.insert(by_name.end(),pending.begin(),pending.end());
+        inplace_merge(by_name.begin(),by_name.begin()+mid,by_name.end(),less);
+        pending.clear();
+    }
+
+    vector<Entry>& table;
+    vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+    vector<uint32_t> by_name;
+    vector<uint32_t> pending;
+};
+
+// the old interface, now with an index
+pair<Entry*,Error_code> complex_search(Entry_index& index, const string& s)
+{
+    auto [found,err] = index.find(s);
+    return {found,err};
+}
+
+void user_indexed(const string& s)
+{
+    static Entry_index index {entry_table}; // build once; use index.add() for new entries afterwards
+    auto [ptr,success] = complex_search(index,s);
+    if (success != Error_code::good)
+    {
+        // ... handle error
+    }
+    // ... use ptr
+}
+
+// benchmark: lookup latency for a linear scan, the hash index, and a prefix query
+// at 1K, 1M, and 10M entries (10M entries need about 1GB of memory)
+void bench_entry_index(vector<size_t> sizes = {1'000, 1'000'000, 10'000'000})
+{
+    for (size_t n : sizes) {
+        vector<Entry> v;
+        v.reserve(n);
+        for (size_t i = 0; i<n; ++i)
+            v.push_back(Entry{"entry"+to_string(i*2654435761%n)});
+        Entry_index index {v};
+
+        vector<string> queries;
+        mt19937 gen;
+        for (int i = 0; i<1000; ++i)
+            queries.push_back("entry"+to_string(gen()%n));
+
+        auto time = [&](auto lookup, int reps) {
+            size_t hits = 0;
+            auto t0 = chrono::steady_clock::now();
+            for (int r = 0; r<reps; ++r)
+                for (const string& q : queries)
+                    hits += lookup(q)!=nullptr;
+            chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+            volatile size_t sink = hits; // keep the lookups
+            (void)sink;
+            return d.count()/(reps*queries.size());
+        };
+
+        int linear_reps = n<=1'000 ? 100 : 1; // a linear scan of 10M entries takes a while
+        double linear = n<=1'000'000 ? time([&](const string& q) { auto p = find_if(v.begin(),v.end(),[&](const Entry& e) { return e.name==q; }); return p==v.end() ? nullptr : &*p; },linear_reps) : NAN;
+        double hashed = time([&](const string& q) { return index.find(q).ptr; },100);
+        double prefix = time([&](const string& q) { auto r = index.with_prefix(q); return r.empty() ? nullptr : r.front(); },10);
+        cout << n << " entries: linear " << linear << " ns, hash " << hashed << " ns, prefix " << prefix << " ns\n";
+    }
+}
+
+// resolving thousands of names one complex_search() at a time wastes two things:
+// each lookup waits for its cache misses before the next can start, and only one core does any work
+
+// a batch interface: a span of queries in, a span of results out (one My_res each, so each result keeps its Error_code)
+// within a batch we hash a group of queries, prefetch their slots, and only then probe,
+// so the cache misses of the group overlap instead of happening one after another
+
+void find_batch(Entry_index& index, span<const string> queries, span<My_res> results)
+{
+    if (results.size()<queries.size())
+        throw out_of_range{"find_batch: results too small"};
+    constexpr size_t group = 16; // enough to cover memory latency, few enough to stay in L1
+    array<size_t,group> h;
+    for (size_t first = 0; first<queries.size(); first += group) {
+        size_t n = min(group,queries.size()-first);
+        for (size_t i = 0; i<n; ++i) {
+            h[i] = Entry_index::hash_of(queries[first+i]); // each query is hashed once
+            index.prefetch(h[i]);
+        }
+        for (size_t i = 0; i<n; ++i)
+            results[first+i] = index.find(queries[first+i],h[i]);
+    }
+}
+
+// the parallel version splits the batch into chunks and lets threads take chunks until none are left
+// a thread that gets easy chunks simply takes more, so uneven chunks don't leave cores idle
+// (std::execution::par_unseq would do, but libstdc++ needs TBB for it, and we want to control the chunk size)
+// lookups only read the index, so threads can share it as long as nobody calls add() meanwhile
+
+void find_batch_parallel(Entry_index& index, span<const string> queries, span<My_res> results, unsigned threads = thread::hardware_concurrency())
+{
+    if (results.size()<queries.size())
+        throw out_of_range{"find_batch_parallel: results too small"};
+    constexpr size_t chunk = 1024;
+    atomic<size_t> next {0};
+    auto work = [&] {
+        for (size_t first; (first = next.fetch_add(chunk))<queries.size();) {
+            size_t n = min(chunk,queries.size()-first);
+            find_batch(index,queries.subspan(first,n),results.subspan(first,n));
+        }
+    };
+    vector<jthread> pool;
+    for (unsigned t = 1; t<threads; ++t)
+        pool.emplace_back(work);
+    work(); // this thread helps too
+} // the jthreads join here
+
+// benchmark: queries per second one at a time, batched on one core, and batched on all cores
+void bench_batch_search(size_t n = 1'000'000, size_t q = 1'000'000)
+{
+    vector<Entry> v;
+    for (size_t i = 0; i<n; ++i)
+        v.push_back(Entry{"entry"+to_string(i)});
+    Entry_index index {v};
+
+    vector<string> queries;
+    mt19937 gen;
+    for (size_t i = 0; i<q; ++i)
+        queries.push_back("entry"+to_string(gen()%(2*n))); // about half of them miss
+    vector<My_res> results(q);
+
+    auto time = [&](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        run();
+        chrono::duration<double> d = chrono::steady_clock::now()-t0;
+        size_t found = count_if(results.begin(),results.end(),[](const My_res& r) { return r.err==Error_code::good; });
+        cout << label << q/d.count()/1e6 << " M queries/s (" << found << " found)\n";
+    };
+
+    time("one at a time:   ",[&] { for (size_t i = 0; i<q; ++i) results[i] = index.find(queries[i]); });
+    time("batched, 1 core: ",[&] { find_batch(index,queries,results); });
+    time("batched, N cores:",[&] { find_batch_parallel(index,queries,results); });
+}
+
+// by now we have three ways of returning a result or an error:
+// My_res{ptr,err}, pair<Entry*,Error_code> from complex_search(), and variant<string,Error_code> from compose_message() (15.4.1)
+// each caller tests each one differently, and a chain of calls that can each fail turns into a ladder of ifs
+
+// Expected<T,E> holds either a T or an error E (like C++23's std::expected<T,E>)
+// a failure is made explicit with failure(e), so an Expected<int,int> isn't ambiguous
+// and_then(), transform(), and or_else() chain steps that can fail, without an if per step:
+//   r.and_then(f): f(*r) if r holds a value (f returns an Expected), else r's error
+//   r.transform(f): Expected{f(*r)} if r holds a value, else r's error
+//   r.or_else(f): r if r holds a value, else f(r.error()) (to recover or to translate the error)
+
+// Expected<T*,E> for a pointer to an aligned T packs the error into the pointer:
+// a T's address always has its low bit 0, so a 1 there means "this is an error, the code is in the other bits"
+// the whole Expected<Entry*> is one word, returned in one register where pair<Entry*,Error_code> needs two
+
+template<typename E>
+struct Failure {
+    E err;
+};
+
+template<typename E>
+Failure<E> failure(E e) { return {e}; }
+
+template<typename E>
+struct Bad_expected_access { // thrown by value() for an Expected holding an error
+    E err;
+};
+
+// the general representation: a union of T and E, and a flag
+template<typename T, typename E>
+class Expected_storage {
+public:
+    Expected_storage(const T& x) : val{x}, ok{true} {}
+    Expected_storage(T&& x) : val{move(x)}, ok{true} {}
+    Expected_storage(Failure<E> f) : err{f.err}, ok{false} {}
+
+    // trivially copyable if T and E are, so that an Expected<int> is passed in registers like an int
+    Expected_storage(const Expected_storage&) requires is_trivially_copy_constructible_v<T> = default;
+    Expected_storage(const Expected_storage& x) : ok{x.ok}
+    {
+        if (ok) new(&val) T(x.val);
+        else new(&err) E(x.err);
+    }
+    Expected_storage(Expected_storage&&) requires is_trivially_move_constructible_v<T> = default;
+    Expected_storage(Expected_storage&& x) noexcept(is_nothrow_move_constructible_v<T>) : ok{x.ok}
+    {
+        if (ok) new(&val) T(move(x.val));
+        else new(&err) E(x.err);
+    }
+    Expected_storage& operator=(const Expected_storage&) requires is_trivially_copy_assignable_v<T> = default;
+    Expected_storage& operator=(const Expected_storage& x)
+    {
+        if (this!=&x) {
+            Expected_storage tmp {x}; // if the copy throws, *this is unchanged
+            *this = move(tmp);
+        }
+        return *this;
+    }
+    Expected_storage& operator=(Expected_storage&&) requires is_trivially_move_assignable_v<T> = default;
+    // if a move of T throws, *this still holds a value or an error, and ok says which
+    Expected_storage& operator=(Expected_storage&& x) noexcept(is_nothrow_move_constructible_v<T> && is_nothrow_move_assignable_v<T>)
+    {
+        if (this==&x)
+            return *this;
+        if (ok && x.ok)
+            val = move(x.val);
+        else if (ok) { // value -> error: copying an E doesn't throw
+            val.~T();
+            new(&err) E(x.err);
+            ok = false;
+        }
+        else if (x.ok) { // error -> value: keep the error until the T is made
+            if constexpr (is_nothrow_move_constructible_v<T>)
+                new(&val) T(move(x.val));
+            else {
+                E e = err;
+                try {
+                    new(&val) T(move(x.val));
+                }
+                catch (...) {
+                    new(&err) E(e); // the failed construction may have overwritten it
+                    throw;
+                }
+            }
+            ok = true;
+        }
+        else
+            err = x.err;
+        return *this;
+    }
+    ~Expected_storage() requires is_trivially_destructible_v<T> = default;
+    ~Expected_storage() { destroy(); }
+
+    bool has_value() const { return ok; }
+    T& get() { return val; }
+    const T& get() const { return val; }
+    E error() const { return err; }
+private:
+    void destroy() { if (ok) val.~T(); }
+
+    union {
+        T val;
+        E err;
+    };
+    bool ok;
+};
+
+// the packed representation: one word for a pointer or an error code
+template<typename T, typename E>
+    requires (alignof(T)>=2 && is_enum_v<E>)
+class Expected_storage<T*,E> {
+public:
+    Expected_storage(T* p) : bits{reinterpret_cast<uintptr_t>(p)} {}
+    Expected_storage(Failure<E> f) : bits{uintptr_t(f.err)<<1 | 1} {} // the code must fit in all but one bit
+
+    bool has_value() const { return (bits&1)==0; }
+    T* get() const { return reinterpret_cast<T*>(bits); }
+    E error() const { return E(bits>>1); }
+private:
+    uintptr_t bits;
+};
+
+template<typename T, typename E = Error_code>
+class Expected : public Expected_storage<T,E> {
+    using Base = Expected_storage<T,E>;
+public:
+    using value_type = T;
+    using error_type = E;
+    using Base::Base;
+    using Base::has_value;
+    using Base::error;
+
+    explicit operator bool() const { return has_value(); }
+
+    decltype(auto) operator*() { return this->get(); } // like *optional: no check
+    decltype(auto) operator*() const { return this->get(); }
+    auto operator->() { if constexpr (is_pointer_v<T>) return this->get(); else return &this->get(); }
+    auto operator->() const { if constexpr (is_pointer_v<T>) return this->get(); else return &this->get(); }
+
+    decltype(auto) value() const // checked
+    {
+        if (!has_value())
+            throw Bad_expected_access<E>{error()};
+        return **this;
+    }
+
+    template<typename U>
+    T value_or(U&& x) const { return has_value() ? T(**this) : T(forward<U>(x)); }
+
+    template<typename F>
+    auto and_then(F&& f) const // f(value) -> Expected<U,E>
+    {
+        using R = remove_cvref_t<invoke_result_t<F,decltype(**this)>>;
+        if (has_value())
+            return R(invoke(forward<F>(f),**this));
+        return R(failure(error()));
+    }
+
+    template<typename F>
+    auto transform(F&& f) const // f(value) -> U
+    {
+        using R = Expected<remove_cvref_t<invoke_result_t<F,decltype(**this)>>,E>;
+        if (has_value())
+            return R(invoke(forward<F>(f),**this));
+        return R(failure(error()));
+    }
+
+    template<typename F>
+    Expected or_else(F&& f) const // f(error) -> Expected<T,E>
+    {
+        if (has_value())
+            return *this;
+        return invoke(forward<F>(f),error());
+    }
+};
+
+static_assert(sizeof(Expected<Entry*>)==sizeof(Entry*)); // packed
+static_assert(is_trivially_copyable_v<Expected<Entry*>> && is_trivially_copyable_v<Expected<int>>);
+
+// to and from the other forms; Error_code::good means "no error" in My_res and pair
+
+inline Expected<Entry*> to_expected(My_res r)
+{
+    if (r.err==Error_code::good) return r.ptr;
+    return failure(r.err);
+}
+
+template<typename T>
+Expected<T> to_expected(pair<T,Error_code> p)
+{
+    if (p.second==Error_code::good) return move(p.first);
+    return failure(p.second);
+}
+
+template<typename T>
+Expected<T> to_expected(variant<T,Error_code> v)
+{
+    if (auto p = get_if<T>(&v)) return move(*p);
+    return failure(get<Error_code>(v));
+}
+
+inline My_res to_res(const Expected<Entry*>& r)
+{
+    if (r) return {*r,Error_code::good};
+    return {nullptr,r.error()};
+}
+
+template<typename T>
+pair<T,Error_code> to_pair(const Expected<T>& r)
+{
+    if (r) return {*r,Error_code::good};
+    return {T{},r.error()};
+}
+
+template<typename T>
+variant<T,Error_code> to_variant(const Expected<T>& r)
+{
+    if (r) return *r;
+    return r.error();
+}
+
+// complex_search() again, and a chain of steps that may each fail
+
+Expected<Entry*> find_entry(Entry_index& index, string_view s)
+{
+    return to_expected(index.find(s));
+}
+
+void user_expected(Entry_index& index, const string& s)
+{
+    auto len = find_entry(index,s)
+        .or_else([&](Error_code) { return find_entry(index,"default"); }) // not there? try another
+        .transform([](Entry* e) { return e->name.size(); }); // Expected<size_t>
+    if (!len) {
+        // ... handle error: len.error() says which
+    }
+    // ... use *len
+}
+
+// benchmark: the success path of a lookup that can fail, reporting failure by exception, pair, and Expected
+// the lookups are kept out of line, so we measure returning the result, not the inlined code
+// with gcc -O2 on x86-64: the exception version returns the pointer in rax, and so does Expected (one word);
+// pair<Entry*,Error_code> returns in rax:rdx and the caller tests rdx; the exception version has no test at all on the way out,
+// but a failure costs microseconds instead of nanoseconds (the last line)
+
+[[gnu::noinline]] Entry* lookup_throw(span<Entry> v, size_t i)
+{
+    if (i>=v.size()) throw Z{};
+    return &v[i];
+}
+
+[[gnu::noinline]] pair<Entry*,Error_code> lookup_pair(span<Entry> v, size_t i)
+{
+    if (i>=v.size()) return {nullptr,Error_code::not_found};
+    return {&v[i],Error_code::good};
+}
+
+[[gnu::noinline]] Expected<Entry*> lookup_expected(span<Entry> v, size_t i)
+{
+    if (i>=v.size()) return failure(Error_code::not_found);
+    return &v[i];
+}
+
+void bench_expected(size_t n = 100'000'000)
+{
+    vector<Entry> v;
+    for (int i = 0; i<1000; ++i)
+        v.push_back(Entry{"entry"+to_string(i)});
+
+    auto time = [](const char* label, size_t n, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        size_t sum = run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/n << " ns per call (" << sum << ")\n";
+    };
+
+    time("exception: ",n,[&] {
+        size_t sum = 0;
+        for (size_t i = 0; i<n; ++i) {
+            try {
+                sum += lookup_throw(v,i%1000)->name.size();
+            }
+            catch (Z) {
+                ++sum;
+            }
+        }
+        return sum;
+    });
+    time("pair:      ",n,[&] {
+        size_t sum = 0;
+        for (size_t i = 0; i<n; ++i) {
+            auto [p,err] = lookup_pair(v,i%1000);
+            sum += err==Error_code::good ? p->name.size() : 1;
+        }
+        return sum;
+    });
+    time("Expected:  ",n,[&] {
+        size_t sum = 0;
+        for (size_t i = 0; i<n; ++i) {
+            auto r = lookup_expected(v,i%1000);
+            sum += r ? r->name.size() : 1;
+        }
+        return sum;
+    });
+    time("exception, failing: ",n/1000,[&] {
+        size_t sum = 0;
+        for (size_t i = 0; i<n/1000; ++i) {
+            try {
+                sum += lookup_throw(v,1000)->name.size();
+            }
+            catch (Z) {
+                ++sum;
+            }
+        }
+        return sum;
+    });
+}
+
+// pair is used for pair of value cases in std library
+//example
+template<typename Forward_iterator, typename T, typename Compare>
+    pair<Forward_iterator,Forward_iterator>
+    equal_range(Forward_iterator first, Forward_iterator last, const T& val, Compare cmp);
+
+// given a sorted sequence [first:last), equal_range() will return the pair representing the subsequence that matches the predicate cmp
+// we can use that to search in a sorted sequence of Records
+
+auto less = [](const Record& r1, const Record& r2) {return r1.name<r2.name;}; // compare names
+
+void f(const vector<Record>& v) // assume that v is sorted on its "name" field
+{
+    auto [first,last] = equal_range(v.begin().v.end(),Record{"Reg"},less);
+
+    for (auto p = first; p!=last; ++p) // print all equal records
+        cout << *p; // assume that << is defined for Record
+}
+
+// each comparison in that equal_range() pulls a whole Record into cache just to look at its name
+// and then follows the name's pointer to its characters: two cache misses per step of the binary search
 
-// shift operatos shift in zeros
+// Record_store keeps the Records sorted, and next to them a column with the first 8 bytes of each name
+// packed into a uint64_t, so comparing the integers compares the prefixes
+// the search runs on that column and only looks at full names when prefixes are equal
 
-// operations to_ullong and to_string() provide the inverse operations to the constructors
-// for example, we can write out the binary representation of an int
+// the prefix column is in Eytzinger order (a binary tree laid out like a heap: children of k are 2k and 2k+1)
+// the first levels of the search then share a few cache lines, and the next level can be prefetched early
+// the search loop has no branch on the comparison, so there is nothing to mispredict
 
-void binary(int i)
-{
-    bitset<8*sizeof(int)> b = i; // assume 8-bit byte 
-    cout << b.to_string() << '\n'; // write out the bits of i
-}
+// assume Record has a string member name, as in the less lambda
 
-void binary2(int i)
+uint64_t name_prefix(string_view s) // the first 8 characters, big-endian, zero padded
 {
-    bitset<8>sizeof(int)> b = i; // assume 8-bit byte
-    cout << b << '\n'; // write out the bits of i
+    uint64_t x = 0;
+    for (size_t i = 0; i<8; ++i)
+        x = x<<8 | (i<s.size() ? static_cast<unsigned char>(s[i]) : 0);
+    return x;
 }
 
-// bitset offers functions for using and manipulating sets of bits
+class Record_store {
+public:
+    explicit Record_store(vector<Record> v) : rows{move(v)}
+    {
+        ranges::stable_sort(rows,name_less);
+        prefix.resize(rows.size());
+        for (size_t i = 0; i<rows.size(); ++i)
+            prefix[i] = name_prefix(rows[i].name);
+        tree.resize(rows.size()+1);
+        tree_pos.resize(rows.size()+1);
+        size_t i = 0;
+        build(1,i);
+    }
 
-// 15.3.3 pair
+    using iterator = vector<Record>::const_iterator;
+    iterator begin() const { return rows.begin(); }
+    iterator end() const { return rows.end(); }
+    size_t size() const { return rows.size(); }
 
-// it's common for a function to return two values
-// simplest and often best way is to define a struct for the purpose
-// for example, we can return a value and a success indicator
+    pair<iterator,iterator> equal_range(string_view name) const
+    {
+        uint64_t key = name_prefix(name);
+        size_t first = lower_bound(key);
+        size_t last = first+prefix_run(first,key); // the Records whose prefix is key
+        // usually a run of one; only here do we look at the full names
+        auto by_name = [](const Record& r, string_view s) { return r.name<s; };
+        auto by_name2 = [](string_view s, const Record& r) { return s<r.name; };
+        auto lo = std::lower_bound(rows.begin()+first,rows.begin()+last,name,by_name);
+        auto hi = std::upper_bound(lo,rows.begin()+last,name,by_name2);
+        return {lo,hi};
+    }
+private:
+    void build(size_t k, size_t& i) // in-order walk of the tree, filling it from the sorted column
+    {
+        if (k>=tree.size()) return;
+        build(2*k,i);
+        tree[k] = prefix[i];
+        tree_pos[k] = uint32_t(i++);
+        build(2*k+1,i);
+    }
 
-struct My_res {
-    Entry* ptr;
-    Error_code err;
-}
+    size_t lower_bound(uint64_t key) const // the first position with prefix>=key
+    {
+        const size_t n = rows.size();
+        size_t k = 1;
+        while (k<=n) {
+            __builtin_prefetch(tree.data()+min(16*k,n)); // four levels ahead: 16 keys = two cache lines
+            k = 2*k+(tree[k]<key); // branchless: the comparison becomes an index
+        }
+        k >>= countr_one(k)+1; // undo the right turns after the last left turn
+        return k==0 ? n : tree_pos[k];
+    }
 
-My_res complex_search(vector<Entry>& v, const string& s)
-{
-    Entry* found = nullptr;
-    Error_code err = Error_code::found;
-    // .. search for s in v ..
-    return {found,err};
-}
+    size_t prefix_run(size_t first, uint64_t key) const // how many prefixes from first on equal key
+    {
+        size_t i = first;
+#if defined(__x86_64__)
+        if (bulk::active==bulk::Isa::avx2)
+            i = prefix_run_avx2(prefix.data(),i,prefix.size(),key);
+#endif
+        while (i<prefix.size() && prefix[i]==key) ++i;
+        return i-first;
+    }
 
-void user(const string& s)
-{
-    My_res r = complex_search(entry_table,s); // search entry_table
-    if (r.err != Error_code::good)
+#if defined(__x86_64__)
+    __attribute__((target("avx2"))) static size_t prefix_run_avx2(const uint64_t* p, size_t i, size_t n, uint64_t key)
     {
-        // ... handle error ...
+        __m256i k = _mm256_set1_epi64x(key);
+        for (; i+4<=n; i += 4) { // compare four prefixes at a time
+            int m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(p+i)),k)));
+            if (m!=0xF)
+                return i+countr_one(unsigned(m));
+        }
+        return i;
     }
-    // use ptr
-}
+#endif
 
-// encoding pair was an end indicator or nullptr might be more elegant, but that can only express one kind of failure
+    static constexpr auto name_less = [](const Record& r1, const Record& r2) { return r1.name<r2.name; };
 
-// often, we want to return two seperate values
-// defining a named struct for each pair of values often works well and is readable if the names of the pair of values structs and their members are well chosen
-// std:: pair provides support for pair of value use cases
+    vector<Record> rows; // sorted by name
+    vector<uint64_t> prefix; // prefix[i] is name_prefix(rows[i].name)
+    vector<uint64_t> tree; // prefix in Eytzinger order, tree[0] unused
+    vector<uint32_t> tree_pos; // tree_pos[k] is the position in rows of tree[k]
+};
 
-std::pair<Entry*, Error_code> complex_search(std::vector<Entry>& v, const std::string& s)
+void f(const Record_store& rs) // same use as for the sorted vector<Record>
 {
-    Entry* found = nullptr;
-    Error_code err = Error_code::found;
-    // ... search for s in v ...
-    return {found, err};
+    auto [first,last] = rs.equal_range("Reg");
+
+    for (auto p = first; p!=last; ++p) // print all equal records
+        cout << *p; // assume that << is defined for Record
 }
 
-void user(const string& s)
+// benchmark: equal_range() on a sorted vector<Record> and on a Record_store with 10M Records
+void bench_record_store(size_t n = 10'000'000, size_t queries = 1'000'000)
 {
-    auto r = complex_search(entry_table,s); // search entry_table
-    if (r.second != Error_code::good) {
-        // .. handle error...
+    mt19937_64 gen;
+    auto random_name = [](uint64_t i) { // names like "Kbqzvtah 123", different in the first few characters
+        string s;
+        for (uint64_t x = i*0x9E3779B97F4A7C15; s.size()<8; x /= 26) s += char('a'+x%26);
+        s[0] = char(toupper(s[0]));
+        return s+' '+to_string(i%1000);
+    };
+
+    vector<Record> v;
+    for (size_t i = 0; i<n; ++i)
+        v.push_back(Record{random_name(gen()%(4*n))});
+    Record_store rs {v};
+    auto name_less = [](const Record& r1, const Record& r2) { return r1.name<r2.name; }; // like less above
+    ranges::sort(v,name_less);
+
+    vector<string> q;
+    for (size_t i = 0; i<queries; ++i)
+        q.push_back(random_name(gen()%(4*n)));
+
+    auto time = [&](const char* label, auto range) {
+        size_t hits = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (const string& s : q) {
+            auto [first,last] = range(s);
+            hits += last-first;
+        }
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/queries << " ns per query (" << hits << " hits)\n";
+    };
+    time("vector<Record>: ",[&](const string& s) { return equal_range(v.begin(),v.end(),Record{s},name_less); });
+    time("Record_store:   ",[&](const string& s) { return rs.equal_range(s); });
+}
+
+// equal_range() needs v sorted, and re-sorting all of v after each batch of inserts costs O(n log n) every time
+// Sorted_blocks keeps the sort invariant as elements come and go
+
+// it's a two-level B+ tree: a vector of blocks, each a sorted vector of at most 2*B elements
+// an insert or erase finds its block by binary search on the blocks' last elements and shifts at most 2*B elements
+// a full block is split in two, an empty block is removed
+// iteration walks the blocks in order, so the elements come out sorted, like from a sorted vector
+
+template<typename T, typename Compare = std::less<>, size_t B = 256>
+class Sorted_blocks {
+public:
+    explicit Sorted_blocks(Compare c = {}) : cmp{c} {}
+
+    class iterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = T;
+        using difference_type = ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() = default;
+        const T& operator*() const { return s->blocks[b][i]; }
+        const T* operator->() const { return &**this; }
+        iterator& operator++()
+        {
+            if (++i==s->blocks[b].size()) { // on to the next block
+                ++b;
+                i = 0;
+            }
+            return *this;
+        }
+        iterator operator++(int) { auto old = *this; ++*this; return old; }
+        bool operator==(const iterator& x) const { return b==x.b && i==x.i; }
+    private:
+        friend Sorted_blocks;
+        iterator(const Sorted_blocks* s, size_t b, size_t i) : s{s}, b{b}, i{i} {}
+        const Sorted_blocks* s = nullptr;
+        size_t b = 0; // block; blocks.size() for end()
+        size_t i = 0; // element in block b
+    };
+
+    iterator begin() const { return {this,0,0}; }
+    iterator end() const { return {this,blocks.size(),0}; }
+    size_t size() const { return n; }
+    bool empty() const { return n==0; }
+
+    void insert(T x) // after any equal elements, like a stable sort would put it
+    {
+        if (blocks.empty()) {
+            blocks.emplace_back().push_back(move(x));
+            ++n;
+            return;
+        }
+        size_t b = block_after(x);
+        if (b==blocks.size()) --b; // bigger than everything: append to the last block
+        auto& blk = blocks[b];
+        blk.insert(std::upper_bound(blk.begin(),blk.end(),x,cmp),move(x));
+        ++n;
+        if (blk.size()>2*B) { // split: the second half becomes a new block
+            vector<T> tail(make_move_iterator(blk.begin()+B),make_move_iterator(blk.end()));
+            blk.erase(blk.begin()+B,blk.end());
+            blocks.insert(blocks.begin()+b+1,move(tail));
+        }
     }
 
-    // use r.first
-}
+    template<typename K>
+    bool erase(const K& k) // erase one element equal to k; false if there is none
+    {
+        auto p = lower_bound(k);
+        if (p==end() || cmp(k,*p))
+            return false;
+        auto& blk = blocks[p.b];
+        blk.erase(blk.begin()+p.i);
+        if (blk.empty())
+            blocks.erase(blocks.begin()+p.b);
+        --n;
+        return true;
+    }
 
-// members of pair are named first and second
-// that makes sense from an implementers point of view, but in application code we may want to use our own names
-// structured binding can be used to deal with that
+    template<typename K>
+    iterator lower_bound(const K& k) const // the first element not less than k
+    {
+        size_t b = block_not_less(k);
+        if (b==blocks.size()) return end();
+        auto& blk = blocks[b];
+        return {this,b,size_t(std::lower_bound(blk.begin(),blk.end(),k,cmp)-blk.begin())};
+    }
 
-void user(const string& s)
-{
-    auto [ptr,success] complex_search(entry_table,s); // search entry_table
-    if (success != Error_code::good)
+    template<typename K>
+    iterator upper_bound(const K& k) const // the first element greater than k
     {
-        // ... handle error
+        size_t b = block_after(k);
+        if (b==blocks.size()) return end();
+        auto& blk = blocks[b];
+        return {this,b,size_t(std::upper_bound(blk.begin(),blk.end(),k,cmp)-blk.begin())};
     }
-    // ... use ptr
-}
 
-// pair is used for pair of value cases in std library
-//example
-template<typename Forward_iterator, typename T, typename Compare>
-    pair<Forward_iterator,Forward_iterator>
-    equal_range(Forward_iterator first, Forward_iterator last, const T& val, Compare cmp);
+    template<typename K>
+    pair<iterator,iterator> equal_range(const K& k) const { return {lower_bound(k),upper_bound(k)}; }
+private:
+    template<typename K>
+    size_t block_not_less(const K& k) const // the first block whose last element is not less than k
+    {
+        return std::partition_point(blocks.begin(),blocks.end(),[&](const vector<T>& blk) { return cmp(blk.back(),k); })-blocks.begin();
+    }
 
-// given a sorted sequence [first:last), equal_range() will return the pair representing the subsequence that matches the predicate cmp
-// we can use that to search in a sorted sequence of Records
+    template<typename K>
+    size_t block_after(const K& k) const // the first block whose last element is greater than k
+    {
+        return std::partition_point(blocks.begin(),blocks.end(),[&](const vector<T>& blk) { return !cmp(k,blk.back()); })-blocks.begin();
+    }
 
-auto less = [](const Record& r1, const Record& r2) {return r1.name<r2.name;}; // compare names
+    vector<vector<T>> blocks; // none empty, each sorted, and every element of a block <= every element of the next
+    size_t n = 0;
+    [[no_unique_address]] Compare cmp;
+};
 
-void f(const vector<Record>& v) // assume that v is sorted on its "name" field
+// the equal_range() example, with Records arriving and leaving while we search
+
+auto by_name = [](const Record& r1, const Record& r2) { return r1.name<r2.name; }; // like less above
+
+void f(Sorted_blocks<Record,decltype(by_name)>& records, const vector<Record>& arrivals)
 {
-    auto [first,last] = equal_range(v.begin().v.end(),Record{"Reg"},less);
+    for (const Record& r : arrivals)
+        records.insert(r); // no re-sort
+
+    auto [first,last] = records.equal_range(Record{"Reg"});
 
     for (auto p = first; p!=last; ++p) // print all equal records
         cout << *p; // assume that << is defined for Record
+
+    records.erase(Record{"Reg"}); // one of them leaves
+}
+
+// the iterators are forward iterators, so std::equal_range(first,last,val,cmp) works too,
+// but it has to step through the elements; the member equal_range() jumps straight to the right block
+
+// benchmark: k batches of inserts, each followed by a query
+// vector<Record> re-sorted after each batch against Sorted_blocks
+void bench_sorted_blocks(size_t batches = 100, size_t batch = 10'000)
+{
+    mt19937_64 gen;
+    auto next = [&gen] { return Record{"rec"+to_string(gen()%100'000'000)}; };
+
+    auto time = [](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        size_t hits = run();
+        chrono::duration<double,milli> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count() << " ms (" << hits << ")\n";
+    };
+
+    time("vector + sort:  ",[&] {
+        vector<Record> v;
+        size_t hits = 0;
+        for (size_t b = 0; b<batches; ++b) {
+            for (size_t i = 0; i<batch; ++i)
+                v.push_back(next());
+            ranges::sort(v,by_name); // "keep v sorted on its name field"
+            auto [first,last] = equal_range(v.begin(),v.end(),next(),by_name);
+            hits += last-first;
+        }
+        return hits;
+    });
+
+    gen.seed(); // same Records again
+    time("Sorted_blocks:  ",[&] {
+        Sorted_blocks<Record,decltype(by_name)> s;
+        size_t hits = 0;
+        for (size_t b = 0; b<batches; ++b) {
+            for (size_t i = 0; i<batch; ++i)
+                s.insert(next());
+            auto [first,last] = s.equal_range(next());
+            hits += distance(first,last);
+        }
+        return hits;
+    });
 }
 
 // a pair provides operators, such as =,==, and <m if its elements do. Type deducion makes it easy to 
@@ -518,31 +4084,664 @@ auto [fish, count, price] = t1;
 cout << fish << '' << count << '' << price << '\n'; // read
 fish = "Sea Bass"; // write
 
-// such binding and its underlying use of type is often used for a function call
+// such binding and its underlying use of type is often used for a function call
+
+auto[fish, count, price] = todays_catch();
+cout << fish << ' ' << count << ' ' << price << '\n';
+
+// real strength of tuple is when you have to store or pass an unknown number of elements
+// or an unknown type as an object
+
+// iterating over the elements of tuple is messy
+// it requires recursion and compile-time evaluation of the function body
+
+template<size_t N = 0, typename... Ts>
+constexpr void print(tuple<Ts...> tup)
+{
+    if constexpr (N<sizeof...(Ts)) { // not yet at the end?
+    cout << get<N>(tup) << ' '; // print the Nth element
+    print<N+1>(tup); // print the next element
+    }
+};
+
+// sizeof(Ts) gives the number of elements of Ts
+// examples of using print
+print(t0); // no output
+print(t2); // Herring 10 1.23
+print(tuple{ "Norah", 17, "Gavin", 14, "Anya", 9, "Courtney", 9, "Ada", 0 });
+
+// the same compile-time walk over the elements can do more than print
+// here it drives a binary serializer: write each element's bytes into a buffer, read them back in the same order
+
+// the format is compact and simple: numbers as their bytes (in the machine's byte order), strings as a 32-bit length and the characters
+// no padding: a tuple<string,int,double> takes 4+size+4+8 bytes
+
+class Writer {
+public:
+    void put(const void* p, size_t n)
+    {
+        auto b = static_cast<const byte*>(p);
+        buf.insert(buf.end(),b,b+n);
+    }
+    void reserve(size_t n) { buf.reserve(buf.size()+n); }
+    const vector<byte>& bytes() const { return buf; }
+    vector<byte> release() { return move(buf); }
+private:
+    vector<byte> buf;
+};
+
+class Reader {
+public:
+    explicit Reader(span<const byte> s) : s{s} {}
+
+    span<const byte> take(size_t n) // the next n bytes; no copy
+    {
+        if (s.size()-pos<n)
+            throw out_of_range{"Reader: not enough bytes"};
+        auto r = s.subspan(pos,n);
+        pos += n;
+        return r;
+    }
+    bool done() const { return pos==s.size(); }
+    size_t remaining() const { return s.size()-pos; }
+private:
+    span<const byte> s;
+    size_t pos = 0;
+};
+
+// aggregates like S can't be taken apart at compile time (no reflection yet),
+// so a type opts in with an as_tuple() that ties its members together
+
+inline auto as_tuple(S& s) { return tie(s.i,s.s,s.d); }
+inline auto as_tuple(const S& s) { return tie(s.i,s.s,s.d); }
+
+template<typename T>
+concept Tuple_like = requires { tuple_size<T>::value; }; // tuple, pair, array
+
+template<typename T>
+concept Described = requires(T& x) { as_tuple(x); };
+
+template<typename T>
+concept Bytewise = is_trivially_copyable_v<T> && has_unique_object_representations_v<T> // no padding
+                   && !is_pointer_v<T> && !is_same_v<T,string_view>; // don't write addresses
+
+template<typename T>
+constexpr bool is_vector = false;
+template<typename T, typename A>
+constexpr bool is_vector<vector<T,A>> = true;
+
+// vector<bool> holds packed bits, not bools: there's no data() to copy from, so it's rejected (use vector<char> or Bits)
+template<typename T>
+constexpr bool is_bool_vector = false;
+template<typename A>
+constexpr bool is_bool_vector<vector<bool,A>> = true;
+
+// the layout is fixed if no element has a length of its own; then we know the size at compile time
+constexpr size_t variable_size = size_t(-1);
+
+template<typename T>
+constexpr size_t fixed_size()
+{
+    if constexpr (is_arithmetic_v<T> || is_enum_v<T> || Bytewise<T>)
+        return sizeof(T);
+    else if constexpr (Tuple_like<T>)
+        return []<size_t... I>(index_sequence<I...>) {
+            constexpr size_t sizes[] = {0,fixed_size<remove_cvref_t<tuple_element_t<I,T>>>()...};
+            size_t sum = 0;
+            for (size_t x : sizes) {
+                if (x==variable_size) return variable_size;
+                sum += x;
+            }
+            return sum;
+        }(make_index_sequence<tuple_size_v<T>>{});
+    else if constexpr (Described<T>)
+        return fixed_size<remove_cvref_t<decltype(as_tuple(declval<T&>()))>>();
+    else
+        return variable_size;
+}
+
+static_assert(fixed_size<tuple<int,double,char>>()==13);
+static_assert(fixed_size<tuple<string,int,double>>()==variable_size);
+
+template<typename T>
+    requires (!is_bool_vector<T>)
+void write(Writer& w, const T& x);
+
+// lengths are 32 bits; a longer string or vector is an error, not something to truncate silently
+inline void write_length(Writer& w, size_t n)
+{
+    if (n>numeric_limits<uint32_t>::max())
+        throw length_error{"write(): more than 2^32-1 elements"};
+    write(w,uint32_t(n));
+}
+
+template<size_t N = 0, typename Tup>
+void write_elements(Writer& w, const Tup& t) // like print<N>(): one element, then the rest
+{
+    if constexpr (N<tuple_size_v<Tup>) {
+        write(w,get<N>(t));
+        write_elements<N+1>(w,t);
+    }
+}
+
+template<typename T>
+    requires (!is_bool_vector<T>)
+void write(Writer& w, const T& x)
+{
+    if constexpr (is_arithmetic_v<T> || is_enum_v<T> || Bytewise<T>) // a run of bytes: one memcpy
+        w.put(&x,sizeof(T));
+    else if constexpr (is_same_v<T,string> || is_same_v<T,string_view>) {
+        write_length(w,x.size());
+        w.put(x.data(),x.size());
+    }
+    else if constexpr (is_vector<T>) {
+        write_length(w,x.size());
+        if constexpr (Bytewise<typename T::value_type> || is_arithmetic_v<typename T::value_type>)
+            w.put(x.data(),x.size()*sizeof(typename T::value_type)); // the whole vector at once
+        else
+            for (const auto& e : x) write(w,e);
+    }
+    else if constexpr (Tuple_like<T>)
+        write_elements(w,x);
+    else if constexpr (Described<T>)
+        write_elements(w,as_tuple(x));
+    else
+        static_assert(Described<T>,"write(): no as_tuple() for this type");
+}
+
+template<typename T>
+    requires (!is_bool_vector<T>)
+T read(Reader& r)
+{
+    if constexpr (is_arithmetic_v<T> || is_enum_v<T> || Bytewise<T>) {
+        T x;
+        memcpy(&x,r.take(sizeof(T)).data(),sizeof(T)); // the bytes needn't be aligned for T
+        return x;
+    }
+    else if constexpr (is_same_v<T,string_view>) { // zero copy: points into the buffer
+        auto n = read<uint32_t>(r);
+        auto b = r.take(n);
+        return {reinterpret_cast<const char*>(b.data()),n};
+    }
+    else if constexpr (is_same_v<T,string>)
+        return string{read<string_view>(r)};
+    else if constexpr (is_vector<T>) {
+        using E = typename T::value_type;
+        auto n = read<uint32_t>(r);
+        // the length comes from the input: check that the bytes are there before allocating for them,
+        // so a corrupt or hostile length throws instead of allocating gigabytes
+        // (a variable-size element takes at least one byte: every string or vector in it has a 4-byte length)
+        constexpr size_t min_bytes = max<size_t>(fixed_size<E>()!=variable_size ? fixed_size<E>() : 1,1);
+        if (n>r.remaining()/min_bytes)
+            throw out_of_range{"Reader: not enough bytes"};
+        T v(n);
+        if constexpr (Bytewise<E> || is_arithmetic_v<E>)
+            memcpy(v.data(),r.take(n*sizeof(E)).data(),n*sizeof(E));
+        else
+            for (auto& e : v) e = read<E>(r);
+        return v;
+    }
+    else if constexpr (Tuple_like<T>) // the elements of a {} list are evaluated left to right, so they're read in order
+        return [&r]<size_t... I>(index_sequence<I...>) { return T{read<tuple_element_t<I,T>>(r)...}; }(make_index_sequence<tuple_size_v<T>>{});
+    else if constexpr (Described<T>) {
+        using Members = decltype(as_tuple(declval<T&>())); // tuple<int&,string&,double&> for S
+        return [&r]<size_t... I>(index_sequence<I...>) {
+            return T{read<remove_cvref_t<tuple_element_t<I,Members>>>(r)...};
+        }(make_index_sequence<tuple_size_v<Members>>{});
+    }
+    else
+        static_assert(Described<T>,"read(): no as_tuple() for this type");
+}
+
+template<typename T>
+vector<byte> serialize(const T& x)
+{
+    Writer w;
+    if constexpr (fixed_size<T>()!=variable_size)
+        w.reserve(fixed_size<T>()); // one allocation
+    write(w,x);
+    return w.release();
+}
+
+template<typename T>
+T deserialize(span<const byte> s)
+{
+    Reader r {s};
+    return read<T>(r);
+}
+
+// a catch record round trip:
+auto catch_bytes = serialize(t1); // tuple<string,int,double>{"Shark",123,3.14}
+auto t4 = deserialize<tuple<string,int,double>>(catch_bytes); // a copy
+auto t5 = deserialize<tuple<string_view,int,double>>(catch_bytes); // get<0>(t5) points into catch_bytes: valid as long as catch_bytes is
+auto s3 = deserialize<S>(serialize(*p1)); // S through as_tuple()
+
+// benchmark: n catch records written and read back as text through a stringstream and as bytes
+void bench_serialize(int n = 1'000'000)
+{
+    vector<tuple<string,int,double>> catches;
+    for (int i = 0; i<n; ++i)
+        catches.emplace_back("Herring"+to_string(i%100),i,i*0.25);
+
+    auto time = [](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        size_t check = run();
+        chrono::duration<double,milli> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count() << " ms (" << check << ")\n";
+    };
+
+    time("iostream:       ",[&] {
+        stringstream ss;
+        for (const auto& [fish,count,price] : catches)
+            ss << fish << ' ' << count << ' ' << price << '\n';
+        size_t sum = 0;
+        string fish; int count; double price;
+        while (ss >> fish >> count >> price)
+            sum += count;
+        return sum;
+    });
+
+    time("binary:         ",[&] {
+        Writer w;
+        for (const auto& c : catches)
+            write(w,c);
+        size_t sum = 0;
+        Reader r {w.bytes()};
+        while (!r.done())
+            sum += get<1>(read<tuple<string_view,int,double>>(r));
+        return sum;
+    });
+}
+
+// print<N>() has two costs we don't need:
+// it takes the tuple by value, so each level of the recursion copies every element (every string) again
+// it instantiates a new function for each N, so a tuple of 10 elements gives 11 print<>()s, each with its own if constexpr
+
+// index_sequence gives us all the indices at once, and a fold expression over the comma operator
+// visits the elements in order: one function, no recursion, no copies
+
+template<typename Tup, typename F>
+    requires Tuple_like<remove_cvref_t<Tup>>
+constexpr void for_each_element(Tup&& t, F&& f) // f(element) for each element, in order
+{
+    [&]<size_t... I>(index_sequence<I...>) {
+        (f(get<I>(forward<Tup>(t))),...); // the comma fold is evaluated left to right
+    }(make_index_sequence<tuple_size_v<remove_cvref_t<Tup>>>{});
+}
+
+template<typename Tup, typename F>
+    requires Tuple_like<remove_cvref_t<Tup>>
+constexpr auto transform_tuple(Tup&& t, F&& f) // tuple{f(element)...}
+{
+    return [&]<size_t... I>(index_sequence<I...>) {
+        return tuple<decltype(f(get<I>(forward<Tup>(t))))...>{f(get<I>(forward<Tup>(t)))...};
+    }(make_index_sequence<tuple_size_v<remove_cvref_t<Tup>>>{});
+}
+
+// get<I>(forward<Tup>(t)) keeps t's value category: an lvalue tuple gives references,
+// an rvalue tuple gives rvalue references, so f can move the elements out
+
+template<Tuple_like Tup>
+void print2(const Tup& tup) // no copies, one instantiation per tuple type
+{
+    for_each_element(tup,[](const auto& x) { cout << x << ' '; });
+}
+
+// print2(t2); // Herring 10 1.23
+// print2(tuple{ "Norah", 17, "Gavin", 14, "Anya", 9, "Courtney", 9, "Ada", 0 });
+
+auto lengths = transform_tuple(tuple{"Shark"s,"Cod"s},[](const string& s) { return s.size(); }); // tuple<size_t,size_t>{5,3}
+
+// measuring it
+
+// run time: count the copies each version makes
+struct Copy_counter {
+    static inline int copies = 0;
+    Copy_counter() = default;
+    Copy_counter(const Copy_counter&) { ++copies; }
+    Copy_counter& operator=(const Copy_counter&) { ++copies; return *this; }
+};
+ostream& operator<<(ostream& os, const Copy_counter&) { return os << "cc"; }
+
+void count_print_copies()
+{
+    tuple<Copy_counter,Copy_counter,Copy_counter,Copy_counter> t;
+    Copy_counter::copies = 0;
+    print(t); // by value at each of the 5 levels: 4+4+4+4+4 copies
+    cout << "\nprint:  " << Copy_counter::copies << " copies\n";
+    Copy_counter::copies = 0;
+    print2(t);
+    cout << "\nprint2: " << Copy_counter::copies << " copies\n"; // 0
+}
+
+// compile time: instantiate both for a tuple of N elements and compare
+//   g++ -std=c++20 -c -ftime-report -DTUPLE_N=200 -DUSE_PRINT   (recursive print)
+//   g++ -std=c++20 -c -ftime-report -DTUPLE_N=200                (for_each_element)
+// the recursive version instantiates N+1 print<>() specializations, the fold one a single print2<>() and one lambda
+// (nm -C on the object file shows them)
+
+#if defined(TUPLE_N)
+template<size_t... I>
+auto make_big_tuple(index_sequence<I...>) { return tuple{int(I)...}; }
+
+void compile_time_benchmark()
+{
+    auto t = make_big_tuple(make_index_sequence<TUPLE_N>{});
+#if defined(USE_PRINT)
+    print(t);
+#else
+    print2(t);
+#endif
+}
+#endif
+
+// a vector<tuple<string,int,double>> of catch records (like t1 and t3) stores whole records one after another
+// with libstdc++ a record is 48 bytes (32 string, 4 int, 4 padding, 8 double), so a scan of one column,
+// "sum all prices", reads 48 bytes from memory for every 8 it uses
+
+// tuple_vector<Ts...> stores each element type in its own vector (columns, or "structure of arrays"):
+// the prices are one contiguous array of doubles, which the compiler can vectorize and threads can split
+// the price: a record is no longer an object in memory, so (*it) and tv[i] return a proxy, tuple_vector_ref,
+// that refers to the i-th element of each column; structured bindings work through it (auto [fish,count,price] = tv[i];
+// names references into the columns), but a proxy is not a tuple&: to keep a copy, convert it to tuple<Ts...>
+
+template<typename... Ts>
+class tuple_vector;
+
+template<bool Const, typename... Ts>
+class tuple_vector_ref {
+    using Columns = conditional_t<Const,const tuple<vector<Ts>...>,tuple<vector<Ts>...>>;
+public:
+    tuple_vector_ref(Columns& c, size_t i) : cols{&c}, pos{i} {}
+    tuple_vector_ref(const tuple_vector_ref&) = default;
+
+    template<size_t I>
+    auto& get() const { return std::get<I>(*cols)[pos]; }
+
+    operator tuple<Ts...>() const // a copy of the record
+    {
+        return [&]<size_t... I>(index_sequence<I...>) { return tuple<Ts...>{get<I>()...}; }(index_sequence_for<Ts...>{});
+    }
+
+    // assignment writes through, like vector<bool>'s reference: *p = *q copies a record, it doesn't rebind p
+    const tuple_vector_ref& operator=(const tuple<Ts...>& t) const requires (!Const)
+    {
+        [&]<size_t... I>(index_sequence<I...>) { ((get<I>() = std::get<I>(t)),...); }(index_sequence_for<Ts...>{});
+        return *this;
+    }
+    const tuple_vector_ref& operator=(tuple<Ts...>&& t) const requires (!Const) // moves the fields in
+    {
+        [&]<size_t... I>(index_sequence<I...>) { ((get<I>() = std::get<I>(move(t))),...); }(index_sequence_for<Ts...>{});
+        return *this;
+    }
+    const tuple_vector_ref& operator=(const tuple_vector_ref& r) const requires (!Const)
+    {
+        return *this = tuple<Ts...>(r);
+    }
+
+    // swap(*p,*q) swaps the records, field by field, like swap() for vector<bool>'s reference; std::iter_swap() needs it
+    friend void swap(tuple_vector_ref a, tuple_vector_ref b) requires (!Const)
+    {
+        [&]<size_t... I>(index_sequence<I...>) { (ranges::swap(a.get<I>(),b.get<I>()),...); }(index_sequence_for<Ts...>{});
+    }
+private:
+    Columns* cols;
+    size_t pos;
+};
+
+// the tuple protocol for the proxy, which is what structured bindings use
+template<bool Const, typename... Ts>
+struct std::tuple_size<tuple_vector_ref<Const,Ts...>> : integral_constant<size_t,sizeof...(Ts)> {};
+
+template<size_t I, bool Const, typename... Ts>
+struct std::tuple_element<I,tuple_vector_ref<Const,Ts...>> {
+    using type = conditional_t<Const,const tuple_element_t<I,tuple<Ts...>>,tuple_element_t<I,tuple<Ts...>>>;
+};
+
+// the proxy and a tuple of (rvalue) references to the same fields, which is what iter_move() gives, meet in a tuple of values:
+// the iterator concepts need such a common reference
+template<bool Const, typename... Ts, typename... Us, template<typename> class TQ, template<typename> class UQ>
+    requires (sizeof...(Ts)==sizeof...(Us)) && (is_same_v<Ts,remove_cvref_t<Us>> && ...)
+struct std::basic_common_reference<tuple_vector_ref<Const,Ts...>,tuple<Us...>,TQ,UQ> {
+    using type = tuple<Ts...>;
+};
+
+template<bool Const, typename... Ts, typename... Us, template<typename> class TQ, template<typename> class UQ>
+    requires (sizeof...(Ts)==sizeof...(Us)) && (is_same_v<Ts,remove_cvref_t<Us>> && ...)
+struct std::basic_common_reference<tuple<Us...>,tuple_vector_ref<Const,Ts...>,TQ,UQ> {
+    using type = tuple<Ts...>;
+};
+
+template<typename... Ts>
+class tuple_vector {
+public:
+    using value_type = tuple<Ts...>;
+    using reference = tuple_vector_ref<false,Ts...>;
+    using const_reference = tuple_vector_ref<true,Ts...>;
+
+    // a forward iterator whose reference is the proxy, so rows work with <algorithm> and ranges
+    // (the proxy converts to value_type, which makes tuple<Ts...> the common reference)
+    // iter_move() gives references to the fields as rvalues, so that algorithms that move rows (ranges::rotate(),
+    // ranges::remove_if(), ...) move each string instead of copying it
+    template<bool Const>
+    class Iterator {
+        using Columns = conditional_t<Const,const tuple<vector<Ts>...>,tuple<vector<Ts>...>>;
+    public:
+        using iterator_concept = forward_iterator_tag;
+        using iterator_category = forward_iterator_tag;
+        using difference_type = ptrdiff_t;
+        using value_type = tuple<Ts...>;
+        using reference = tuple_vector_ref<Const,Ts...>;
+
+        Iterator() = default;
+        Iterator(Columns& c, size_t i) : cols{&c}, pos{i} {}
+        reference operator*() const { return {*cols,pos}; }
+        Iterator& operator++() { ++pos; return *this; }
+        Iterator operator++(int) { Iterator t = *this; ++pos; return t; }
+        bool operator==(const Iterator& x) const { return pos==x.pos; }
+
+        friend auto iter_move(const Iterator& it)
+        {
+            return [&]<size_t... I>(index_sequence<I...>) {
+                return tuple<conditional_t<Const,const Ts&&,Ts&&>...>{move(std::get<I>(*it.cols)[it.pos])...};
+            }(index_sequence_for<Ts...>{});
+        }
+    private:
+        Columns* cols = nullptr;
+        size_t pos = 0;
+    };
+
+    size_t size() const { return std::get<0>(cols).size(); }
+    bool empty() const { return size()==0; }
+    void reserve(size_t n) { for_each_column([n](auto& c) { c.reserve(n); }); }
+    void clear() { for_each_column([](auto& c) { c.clear(); }); }
+
+    reference operator[](size_t i) { return {cols,i}; }
+    const_reference operator[](size_t i) const { return {cols,i}; }
+    reference back() { return {cols,size()-1}; }
+
+    Iterator<false> begin() { return {cols,0}; }
+    Iterator<false> end() { return {cols,size()}; }
+    Iterator<true> begin() const { return {cols,0}; }
+    Iterator<true> end() const { return {cols,size()}; }
+
+    template<typename... Args>
+        requires (sizeof...(Args)==sizeof...(Ts))
+    reference emplace_back(Args&&... args) // one argument per column
+    {
+        auto a = forward_as_tuple(forward<Args>(args)...);
+        size_t done = 0;
+        try {
+            [&]<size_t... I>(index_sequence<I...>) {
+                ((std::get<I>(cols).emplace_back(std::get<I>(move(a))), ++done),...);
+            }(index_sequence_for<Ts...>{});
+        }
+        catch (...) { // undo the columns that got their element, so that the columns stay the same length
+            [&]<size_t... I>(index_sequence<I...>) {
+                ((I<done ? std::get<I>(cols).pop_back() : void()),...);
+            }(index_sequence_for<Ts...>{});
+            throw;
+        }
+        return back();
+    }
+
+    void push_back(const tuple<Ts...>& t) { apply([this](const auto&... x) { emplace_back(x...); },t); }
+    void push_back(tuple<Ts...>&& t) { apply([this](auto&... x) { emplace_back(move(x)...); },t); }
+
+    // the columns; a span can't change the length, so the columns can't get out of step through it
+    template<size_t I> span<tuple_element_t<I,value_type>> column() { return std::get<I>(cols); }
+    template<size_t I> span<const tuple_element_t<I,value_type>> column() const { return std::get<I>(cols); }
+
+    // get<I>(tv) and get<T>(tv) give a column, the way get<I>(t) and get<T>(t) give an element of a tuple
+    // (get<T> requires T to be the type of exactly one column)
+    // hidden friends: found only by ADL on a tuple_vector, so they don't join every other unqualified get() in the file
+    template<size_t I>
+    friend auto get(tuple_vector& tv) { return tv.template column<I>(); }
+    template<size_t I>
+    friend auto get(const tuple_vector& tv) { return tv.template column<I>(); }
+    template<typename T>
+        requires ((is_same_v<T,Ts>+...)==1)
+    friend auto get(tuple_vector& tv) { return tv.template column<index_of<T>()>(); }
+    template<typename T>
+        requires ((is_same_v<T,Ts>+...)==1)
+    friend auto get(const tuple_vector& tv) { return tv.template column<index_of<T>()>(); }
+private:
+    template<typename T>
+    static constexpr size_t index_of()
+    {
+        constexpr bool same[] = {is_same_v<T,Ts>...};
+        return size_t(find(std::begin(same),std::end(same),true)-std::begin(same));
+    }
+
+    template<typename F>
+    void for_each_column(F f) { apply([&f](auto&... c) { (f(c),...); },cols); }
+
+    tuple<vector<Ts>...> cols;
+};
+
+static_assert(forward_iterator<tuple_vector<string,int,double>::Iterator<false>>);
+static_assert(forward_iterator<tuple_vector<string,int,double>::Iterator<true>>);
+static_assert(permutable<tuple_vector<string,int,double>::Iterator<false>>);
+
+// std::rotate() swaps rows through swap(tuple_vector_ref,tuple_vector_ref); this doesn't compile without it
+inline void rotate_rows(tuple_vector<string,int,double>& tv, size_t n)
+{
+    std::rotate(tv.begin(),next(tv.begin(),ptrdiff_t(n)),tv.end());
+}
+
+// column aggregates
+// a slice of ints goes to bulk::sum(); for other types, several independent accumulators break the dependency chain
+// of a single sum, so the additions can overlap (and for floating-point, the compiler can't reorder them itself)
+// the parallel version splits the column into one contiguous slice per thread, like find_batch_parallel()
+// (and, as there, not std::execution::par_unseq: libstdc++ needs TBB for it)
+
+template<typename T>
+using Sum_type = conditional_t<is_integral_v<T>,long long,T>;
+
+template<typename T>
+Sum_type<remove_const_t<T>> column_sum_serial(span<T> s)
+{
+    using S = Sum_type<remove_const_t<T>>;
+    if constexpr (is_same_v<remove_const_t<T>,int>)
+        return bulk::sum(s);
+    else {
+        constexpr size_t k = 8;
+        S acc[k] {};
+        size_t i = 0;
+        for (; i+k<=s.size(); i += k)
+            for (size_t j = 0; j<k; ++j) acc[j] += s[i+j];
+        for (; i<s.size(); ++i) acc[0] += s[i];
+        return accumulate(begin(acc),end(acc),S{});
+    }
+}
+
+template<typename T>
+Sum_type<remove_const_t<T>> column_sum(span<T> s, unsigned threads = thread::hardware_concurrency())
+{
+    constexpr size_t min_slice = 1<<16; // below this, starting a thread costs more than it saves
+    threads = unsigned(clamp<size_t>(s.size()/min_slice,1,max(threads,1u)));
+    if (threads==1)
+        return column_sum_serial(s);
+    vector<Sum_type<remove_const_t<T>>> sums(threads);
+    {
+        vector<jthread> pool;
+        size_t slice = (s.size()+threads-1)/threads;
+        for (unsigned t = 0; t<threads; ++t)
+            pool.emplace_back([&,t] {
+                size_t first = min(s.size(),t*slice);
+                sums[t] = column_sum_serial(s.subspan(first,min(slice,s.size()-first)));
+            });
+    } // the jthreads join here
+    return accumulate(sums.begin(),sums.end(),Sum_type<remove_const_t<T>>{});
+}
 
-auto[fish, count, price] = todays_catch();
-cout << fish << ' ' << count << ' ' << price << '\n';
+void user_catches()
+{
+    tuple_vector<string,int,double> catches;
+    catches.push_back(t1);
+    catches.push_back(t3);
+    catches.emplace_back("Herring",10,1.23);
 
-// real strength of tuple is when you have to store or pass an unknown number of elements
-// or an unknown type as an object
+    for (auto [fish,count,price] : catches) // fish, count, and price refer into the columns
+        if (fish=="Cod") price *= 1.1; // raises the price in the catches
 
-// iterating over the elements of tuple is messy
-// it requires recursion and compile-time evaluation of the function body
+    double total = column_sum(get<double>(catches)); // get<2>(catches) is the same column
+    tuple<string,int,double> first = catches[0]; // a copy
+    // ...
+    (void)total; (void)first;
+}
 
-template<size_t N = 0, typename... Ts>
-constexpr void print(tuple<Ts...> tup)
+// benchmark: n catch records as vector<tuple<string,int,double>> and as tuple_vector<string,int,double>
+// summing one column reads 8 (or 4) bytes per record instead of 48; using every field, the layouts are close
+void bench_tuple_vector(size_t n = 10'000'000, int reps = 10)
 {
-    if constexpr (N<sizeof...(Ts)) { // not yet at the end?
-    cout << get<N>(tup) << ' '; // print the Nth element
-    print<N+1>(tup); // print the next element
+    vector<tuple<string,int,double>> rows;
+    tuple_vector<string,int,double> cols;
+    rows.reserve(n);
+    cols.reserve(n);
+    for (size_t i = 0; i<n; ++i) {
+        rows.emplace_back("Herring"+to_string(i%100),int(i%1000),(i%1000)*0.25);
+        cols.emplace_back("Herring"+to_string(i%100),int(i%1000),(i%1000)*0.25);
     }
-};
-
-// sizeof(Ts) gives the number of elements of Ts
-// examples of using print
-print(t0); // no output
-print(t2); // Herring 10 1.23
-print(tuple{ "Norah", 17, "Gavin", 14, "Anya", 9, "Courtney", 9, "Ada", 0 });
+    cout << "bytes per record: vector<tuple> " << sizeof(tuple<string,int,double>)
+         << ", tuple_vector " << sizeof(string)+sizeof(int)+sizeof(double) << '\n';
+
+    auto time = [&](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        double check = 0;
+        for (int r = 0; r<reps; ++r) check += run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/(reps*n) << " ns per record (" << check/reps << ")\n";
+    };
+
+    // the vector<tuple> sums use column_sum_serial()'s 8 accumulators too, so the pairs differ only in the layout
+    auto rows_sum = [&]<size_t I>() {
+        using S = Sum_type<tuple_element_t<I,tuple<string,int,double>>>;
+        constexpr size_t k = 8;
+        S acc[k] {};
+        size_t i = 0;
+        for (; i+k<=rows.size(); i += k)
+            for (size_t j = 0; j<k; ++j) acc[j] += get<I>(rows[i+j]);
+        for (; i<rows.size(); ++i) acc[0] += get<I>(rows[i]);
+        return double(accumulate(begin(acc),end(acc),S{}));
+    };
+
+    time("vector<tuple> sum prices:        ",[&] { return rows_sum.template operator()<2>(); });
+    time("tuple_vector sum prices, 1 core: ",[&] { return column_sum(get<double>(cols),1); });
+    time("tuple_vector sum prices:         ",[&] { return column_sum(get<double>(cols)); });
+    time("vector<tuple> sum counts:        ",[&] { return rows_sum.template operator()<1>(); });
+    time("tuple_vector sum counts:         ",[&] { return double(column_sum(get<int>(cols))); });
+    time("vector<tuple> all fields:        ",[&] {
+        double s = 0;
+        for (const auto& [fish,count,price] : rows) s += fish.size()+count*price;
+        return s;
+    });
+    time("tuple_vector all fields:         ",[&] {
+        double s = 0;
+        for (auto [fish,count,price] : as_const(cols)) s += fish.size()+count*price;
+        return s;
+    });
+}
 
 // tuples provide whatever operators its elements provide
 // tuple and pair can convert to one another if tuple has two members
@@ -632,6 +4831,311 @@ overloaded(Ts...) -> overloaded<Ts...>; // deduction guide
 // deduction guide: a mechanism for resolve ambiguites, particualy for constructors of class templates in foundation libraries
 // bad_variant_access error is thrown if we try to access a variant holding a different type from the expected one.
 
+// "potentially faster" depends on how visit() is implemented
+// some implementations dispatch through a table of function pointers, which can't be inlined,
+// some generate a chain of comparisons, and for several variants std::visit builds a table for every combination
+
+// fast_visit() makes the dispatch explicit:
+// up to 16 alternatives: a switch on index(), which compilers turn into a jump table and where f can be inlined
+// more than that: a table of function pointers, one entry per alternative
+
+// std::unreachable() is C++23; until then:
+[[noreturn]] inline void not_reached() { __builtin_unreachable(); } // gcc/clang; MSVC: __assume(false)
+
+// the switch, written once for both fast_visit()s: a case for each possible index below 16;
+// call.template operator()<i>() does the work for index i, and the cases beyond n are never reached
+#define NOTES_VISIT_CASE(i) case i: if constexpr (i<n) return call.template operator()<i>(); else not_reached();
+#define NOTES_VISIT_SWITCH(x) \
+    switch (x) { \
+    NOTES_VISIT_CASE(0) NOTES_VISIT_CASE(1) NOTES_VISIT_CASE(2) NOTES_VISIT_CASE(3) \
+    NOTES_VISIT_CASE(4) NOTES_VISIT_CASE(5) NOTES_VISIT_CASE(6) NOTES_VISIT_CASE(7) \
+    NOTES_VISIT_CASE(8) NOTES_VISIT_CASE(9) NOTES_VISIT_CASE(10) NOTES_VISIT_CASE(11) \
+    NOTES_VISIT_CASE(12) NOTES_VISIT_CASE(13) NOTES_VISIT_CASE(14) NOTES_VISIT_CASE(15) \
+    } \
+    not_reached();
+
+template<typename F, typename V>
+decltype(auto) fast_visit(F&& f, V&& v)
+{
+    using Var = remove_cvref_t<V>;
+    constexpr size_t n = variant_size_v<Var>;
+    if (v.valueless_by_exception())
+        throw bad_variant_access{};
+
+    if constexpr (n<=16) {
+        auto call = [&]<size_t I>() -> decltype(auto) { return f(get<I>(forward<V>(v))); };
+        NOTES_VISIT_SWITCH(v.index())
+    }
+    else {
+        using R = decltype(f(get<0>(forward<V>(v))));
+        constexpr auto table = []<size_t... I>(index_sequence<I...>) {
+            return array<R(*)(F&&,V&&),n>{[](F&& f, V&& v) -> R { return f(get<I>(forward<V>(v))); }...};
+        }(make_index_sequence<n>{});
+        return table[v.index()](forward<F>(f),forward<V>(v));
+    }
+}
+
+// several variants: f has to be instantiated for every combination of alternatives (n1*n2*...); nothing can avoid that
+// what we can avoid is dispatching on each variant in turn: nested fast_visit()s would give n1 separately instantiated
+// inner dispatches of n2 cases each, and a jump per variant
+// instead, the indices are combined into one number, like digits in bases n1, n2, ... (the first variant is the
+// most significant digit), and there is one jump: a switch for up to 16 combinations, else one table of function pointers
+
+template<typename... Vs>
+constexpr array variant_sizes {variant_size_v<remove_cvref_t<Vs>>...};
+
+template<auto Sizes> // array<size_t,k>: the variant sizes
+constexpr auto digits_of(size_t combined) // combined index -> the index of each variant
+{
+    auto d = Sizes;
+    for (size_t j = Sizes.size(); j-->0;) {
+        d[j] = combined%Sizes[j];
+        combined /= Sizes[j];
+    }
+    return d;
+}
+
+template<auto Sizes, size_t Combined, typename R, typename F, typename Args>
+R visit_combination(F&& f, Args& args) // args: a tuple of forwarding references to the variants
+{
+    constexpr auto d = digits_of<Sizes>(Combined);
+    return [&]<size_t... J>(index_sequence<J...>) -> R {
+        return f(get<d[J]>(get<J>(move(args)))...);
+    }(make_index_sequence<Sizes.size()>{});
+}
+
+template<typename F, typename V1, typename V2, typename... Vs>
+decltype(auto) fast_visit(F&& f, V1&& v1, V2&& v2, Vs&&... vs)
+{
+    if (v1.valueless_by_exception() || v2.valueless_by_exception() || (vs.valueless_by_exception() || ...))
+        throw bad_variant_access{};
+
+    using Args = tuple<V1&&,V2&&,Vs&&...>;
+    using R = decltype(f(get<0>(forward<V1>(v1)),get<0>(forward<V2>(v2)),get<0>(forward<Vs>(vs))...));
+    constexpr auto& sizes = variant_sizes<V1,V2,Vs...>;
+    constexpr size_t n = accumulate(sizes.begin(),sizes.end(),size_t{1},multiplies<>{}); // the number of combinations
+
+    size_t combined = 0;
+    size_t j = 0;
+    for (size_t i : {v1.index(),v2.index(),vs.index()...})
+        combined = combined*sizes[j++]+i;
+
+    Args args {forward<V1>(v1),forward<V2>(v2),forward<Vs>(vs)...};
+    if constexpr (n<=16) {
+        auto call = [&]<size_t I>() -> R { return visit_combination<variant_sizes<V1,V2,Vs...>,I,R>(forward<F>(f),args); };
+        NOTES_VISIT_SWITCH(combined)
+    }
+    else {
+        constexpr auto table = []<size_t... I>(index_sequence<I...>) {
+            return array<R(*)(F&&,Args&),n>{&visit_combination<variant_sizes<V1,V2,Vs...>,I,R,F,Args>...};
+        }(make_index_sequence<n>{});
+        return table[combined](forward<F>(f),args);
+    }
+}
+
+#undef NOTES_VISIT_SWITCH
+#undef NOTES_VISIT_CASE
+
+// a batch of nodes: one call, one loop, and the compiler can see the whole dispatch
+template<typename F, typename V>
+void visit_all(F&& f, span<V> nodes)
+{
+    for (V& v : nodes)
+        fast_visit(f,v);
+}
+
+void check(span<Node> nodes)
+{
+    visit_all(overloaded {
+        [](Expression& e) { /* ... */ },
+        [](Statement& s) { /* ... */ },
+        [](Declaration& d) { /* ... */ },
+        [](Type& t) { /* ... */ },
+    }, nodes);
+}
+
+// benchmark: the four ways of dispatching over a node with four alternatives
+// holds_alternative chains, std::visit, fast_visit, and a class hierarchy with a virtual function
+
+namespace bench_nodes {
+    struct Expr { int v; };
+    struct Stmt { int v; };
+    struct Decl { int v; };
+    struct Typ { int v; };
+    using Var = variant<Expr,Stmt,Decl,Typ>;
+
+    struct Base { virtual ~Base() = default; virtual int eval() const = 0; };
+    struct Expr_node : Base { int v; explicit Expr_node(int v) : v{v} {} int eval() const override { return v+1; } };
+    struct Stmt_node : Base { int v; explicit Stmt_node(int v) : v{v} {} int eval() const override { return v*2; } };
+    struct Decl_node : Base { int v; explicit Decl_node(int v) : v{v} {} int eval() const override { return v-3; } };
+    struct Typ_node : Base { int v; explicit Typ_node(int v) : v{v} {} int eval() const override { return v^5; } };
+
+    auto eval = overloaded {
+        [](const Expr& e) { return e.v+1; },
+        [](const Stmt& s) { return s.v*2; },
+        [](const Decl& d) { return d.v-3; },
+        [](const Typ& t) { return t.v^5; },
+    };
+}
+
+void bench_visit(size_t n = 1'000'000, int reps = 20)
+{
+    using namespace bench_nodes;
+    vector<Var> vars;
+    vector<unique_ptr<Base>> objs;
+    mt19937 gen;
+    for (size_t i = 0; i<n; ++i) {
+        int v = int(gen()%1000);
+        switch (gen()%4) { // a random mix, so the branch predictor can't learn the order
+        case 0: vars.emplace_back(Expr{v}); objs.push_back(make_unique<Expr_node>(v)); break;
+        case 1: vars.emplace_back(Stmt{v}); objs.push_back(make_unique<Stmt_node>(v)); break;
+        case 2: vars.emplace_back(Decl{v}); objs.push_back(make_unique<Decl_node>(v)); break;
+        default: vars.emplace_back(Typ{v}); objs.push_back(make_unique<Typ_node>(v)); break;
+        }
+    }
+
+    auto time = [&](const char* label, auto run) {
+        long long sum = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r<reps; ++r) sum += run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/(reps*n) << " ns per node (" << sum << ")\n";
+    };
+
+    time("holds_alternative: ",[&] {
+        long long s = 0;
+        for (const Var& x : vars) {
+            if (holds_alternative<Expr>(x)) s += eval(get<Expr>(x));
+            else if (holds_alternative<Stmt>(x)) s += eval(get<Stmt>(x));
+            else if (holds_alternative<Decl>(x)) s += eval(get<Decl>(x));
+            else s += eval(get<Typ>(x));
+        }
+        return s;
+    });
+    time("std::visit:        ",[&] { long long s = 0; for (const Var& x : vars) s += visit(eval,x); return s; });
+    time("fast_visit:        ",[&] { long long s = 0; for (const Var& x : vars) s += fast_visit(eval,x); return s; });
+    time("virtual function:  ",[&] { long long s = 0; for (const auto& p : objs) s += p->eval(); return s; });
+}
+
+// with a random mix of nodes, the branch (or jump) on the alternative is mispredicted again and again
+// when the order doesn't matter, we can avoid the question altogether: keep each alternative in its own vector
+// then visiting the whole collection is one tight loop per type, with no dispatch per node
+// (and with small alternatives stored without the variant's padding)
+
+// Bucketed<Ts...> keeps a vector for each type, plus an index of (type,position) pairs remembering the original order,
+// for the operations that do need it
+
+template<typename... Ts>
+class Bucketed {
+public:
+    template<typename T>
+    void push_back(T x) // x must be one of the Ts
+    {
+        constexpr size_t I = type_index<T>();
+        auto& bucket = get<I>(buckets);
+        order.push_back({uint32_t(I),uint32_t(bucket.size())});
+        bucket.push_back(move(x));
+    }
+
+    void push_back(const variant<Ts...>& v)
+    {
+        fast_visit([this](const auto& x) { push_back(x); },v);
+    }
+
+    size_t size() const { return order.size(); }
+
+    template<typename T>
+    span<T> bucket() { return get<type_index<T>()>(buckets); } // all the Ts, in the order they were added
+
+    template<typename F>
+    void visit(F&& f) // type by type: f(x) for every element, grouped by type
+    {
+        apply([&](auto&... bucket) { (for_each_in(bucket,f),...); },buckets);
+    }
+
+    template<typename F>
+    void visit_in_order(F&& f) // f(x) for every element in the original order; pays for the dispatch again
+    {
+        for (auto [type,pos] : order)
+            visit_at(type,pos,f);
+    }
+private:
+    template<typename T>
+    static constexpr size_t type_index()
+    {
+        constexpr bool match[] = {is_same_v<T,Ts>...};
+        for (size_t i = 0; i<sizeof...(Ts); ++i)
+            if (match[i]) return i;
+        throw "Bucketed: not one of the types"; // a compile-time error, since this is only used in constant expressions
+    }
+
+    template<typename Vec, typename F>
+    static void for_each_in(Vec& v, F& f)
+    {
+        for (auto& x : v)
+            f(x);
+    }
+
+    template<typename F>
+    void visit_at(uint32_t type, uint32_t pos, F& f)
+    {
+        [&]<size_t... I>(index_sequence<I...>) {
+            ((type==I ? (f(get<I>(buckets)[pos]),true) : false) || ...); // the compiler makes this a switch
+        }(index_sequence_for<Ts...>{});
+    }
+
+    struct Where {
+        uint32_t type;
+        uint32_t pos;
+    };
+
+    tuple<vector<Ts>...> buckets;
+    vector<Where> order;
+};
+
+using Node_store = Bucketed<Expression,Statement,Declaration,Type>;
+
+void check(Node_store& nodes)
+{
+    nodes.visit(overloaded {
+        [](Expression& e) { /* ... */ }, // called for all Expressions, then
+        [](Statement& s) { /* ... */ }, // for all Statements, and so on
+        [](Declaration& d) { /* ... */ },
+        [](Type& t) { /* ... */ },
+    });
+}
+
+// benchmark: visiting a random mix of nodes in source order in a vector<Var>, and bucketed by type
+void bench_bucketed(size_t n = 1'000'000, int reps = 20)
+{
+    using namespace bench_nodes;
+    vector<Var> vars;
+    Bucketed<Expr,Stmt,Decl,Typ> buckets;
+    mt19937 gen;
+    for (size_t i = 0; i<n; ++i) {
+        int v = int(gen()%1000);
+        switch (gen()%4) {
+        case 0: vars.emplace_back(Expr{v}); break;
+        case 1: vars.emplace_back(Stmt{v}); break;
+        case 2: vars.emplace_back(Decl{v}); break;
+        default: vars.emplace_back(Typ{v}); break;
+        }
+        buckets.push_back(vars.back());
+    }
+
+    auto time = [&](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        long long sum = 0;
+        for (int r = 0; r<reps; ++r) sum += run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/(reps*n) << " ns per node (" << sum << ")\n";
+    };
+
+    time("vector<Var>, fast_visit: ",[&] { long long s = 0; for (const Var& x : vars) s += fast_visit(eval,x); return s; });
+    time("Bucketed, by type:       ",[&] { long long s = 0; buckets.visit([&](const auto& x) { s += eval(x); }); return s; });
+    time("Bucketed, in order:      ",[&] { long long s = 0; buckets.visit_in_order([&](const auto& x) { s += eval(x); }); return s; });
+}
+
 // 15.4.2 optional
 
 //optional<A> can be seen as a special kind of variant (like a variant<A,nothing>)
@@ -679,6 +5183,273 @@ int sum2(optional<int> a, optional<int> b)
     return *a+*b; // asking for trouble
 }
 
+// an optional<int> needs a bool next to the int, so with padding it takes 8 bytes for 4 bytes of data
+// a vector<optional<int>> is twice the size of a vector<int>, and half of every cache line it occupies is flags
+
+// often a type has a value we never use, which can stand for "no value":
+// INT_MIN for a count or an index, NaN for a measurement, nullptr for a pointer
+// compact_optional<T,Sentinel> uses such a value (given by Sentinel) as "empty", so it's exactly the size of T
+// the price: that value can't be stored as a value; storing it gives an empty compact_optional
+
+template<typename T>
+struct Min_sentinel { // for integers: numeric_limits<T>::min()
+    static constexpr T empty() { return numeric_limits<T>::min(); }
+    static constexpr bool is_empty(T x) { return x==empty(); }
+};
+
+template<typename T>
+struct Nan_sentinel { // for floating-point: a quiet NaN; any NaN counts as empty
+    static constexpr T empty() { return numeric_limits<T>::quiet_NaN(); }
+    static constexpr bool is_empty(T x) { return x!=x; }
+};
+
+template<typename T>
+struct Null_sentinel { // for pointers
+    static constexpr T empty() { return nullptr; }
+    static constexpr bool is_empty(T x) { return x==nullptr; }
+};
+
+template<typename T>
+using Default_sentinel = conditional_t<is_floating_point_v<T>,Nan_sentinel<T>,conditional_t<is_pointer_v<T>,Null_sentinel<T>,Min_sentinel<T>>>;
+
+// *x and x-> are checked unless NOTES_CHECKED_OPTIONAL is 0, which is the default only when NDEBUG is defined (like NOTES_CHECKED_SPAN)
+// like the checked Span, a failed check reports and stops: it's a bug, not an error to be handled
+#ifndef NOTES_CHECKED_OPTIONAL
+#ifdef NDEBUG
+#define NOTES_CHECKED_OPTIONAL 0
+#else
+#define NOTES_CHECKED_OPTIONAL 1
+#endif
+#endif
+
+template<typename T, typename Sentinel = Default_sentinel<T>>
+class compact_optional {
+public:
+    using value_type = T;
+
+    constexpr compact_optional() = default;
+    constexpr compact_optional(nullopt_t) {}
+    constexpr compact_optional(T x) : val{x} {}
+
+    constexpr bool has_value() const { return !Sentinel::is_empty(val); }
+    constexpr explicit operator bool() const { return has_value(); }
+
+    constexpr const T& operator*() const { check(); return val; }
+    constexpr T& operator*() { check(); return val; }
+    constexpr const T* operator->() const { check(); return &val; }
+
+    constexpr const T& value() const // always checked, like optional::value()
+    {
+        if (!has_value())
+            throw bad_optional_access{};
+        return val;
+    }
+    constexpr T value_or(T x) const { return has_value() ? val : x; }
+
+    constexpr void reset() { val = Sentinel::empty(); }
+    constexpr T& emplace(T x) { val = x; return val; }
+
+    constexpr T raw() const { return val; } // the stored value, sentinel or not, for code that handles empties itself
+
+    friend constexpr bool operator==(compact_optional a, compact_optional b)
+    {
+        return a.has_value() ? b.has_value() && a.val==b.val : !b.has_value();
+    }
+    friend constexpr bool operator==(compact_optional a, nullopt_t) { return !a.has_value(); }
+private:
+    constexpr void check() const
+    {
+        if constexpr (NOTES_CHECKED_OPTIONAL) {
+            if (!has_value()) {
+                fprintf(stderr,"compact_optional: access to an empty optional\n");
+                abort();
+            }
+        }
+    }
+
+    T val = Sentinel::empty();
+};
+
+static_assert(sizeof(compact_optional<int>)==sizeof(int));
+static_assert(sizeof(compact_optional<double>)==sizeof(double));
+static_assert(sizeof(compact_optional<Entry*>)==sizeof(Entry*));
+static_assert(is_trivially_copyable_v<compact_optional<int>>);
+
+// the same interface, so the same code as sum() and sum2()
+// (not overloads of them: sum(17,19) would then be ambiguous)
+
+int sum_compact(compact_optional<int> a, compact_optional<int> b)
+{
+    int res = 0;
+    if (a) res +=*a;
+    if (b) res +=*b;
+    return res;
+}
+
+int sum2_compact(compact_optional<int> a, compact_optional<int> b)
+{
+    return *a+*b; // still asking for trouble, but a checked build stops with a message instead of adding INT_MIN
+}
+
+// a span<const compact_optional<int>> is a span of ints in memory, so reductions over it are vector loops over ints:
+// compare with INT_MIN to get a mask of the empties, then ignore those lanes
+// (other Ts get the plain loops)
+
+namespace bulk {
+
+inline long long present_sum_scalar(const int* p, size_t n)
+{
+    long long s = 0;
+    for (size_t i = 0; i<n; ++i)
+        if (p[i]!=INT_MIN) s += p[i];
+    return s;
+}
+
+inline size_t present_count_scalar(const int* p, size_t n)
+{
+    size_t c = 0;
+    for (size_t i = 0; i<n; ++i) c += p[i]!=INT_MIN;
+    return c;
+}
+
+inline int present_min_scalar(const int* p, size_t n, int m) // INT_MIN is the smallest int, so empties must be skipped
+{
+    for (size_t i = 0; i<n; ++i)
+        if (p[i]!=INT_MIN) m = min(m,p[i]);
+    return m;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) inline long long present_sum_avx2(const int* p, size_t n)
+{
+    const __m256i empty = _mm256_set1_epi32(INT_MIN);
+    __m256i acc = _mm256_setzero_si256(); // four 64-bit sums
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p+i));
+        x = _mm256_andnot_si256(_mm256_cmpeq_epi32(x,empty),x); // empties become 0
+        acc = _mm256_add_epi64(acc,_mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        acc = _mm256_add_epi64(acc,_mm256_cvtepi32_epi64(_mm256_extracti128_si256(x,1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+present_sum_scalar(p+i,n-i);
+}
+
+__attribute__((target("avx2"))) inline size_t present_count_avx2(const int* p, size_t n)
+{
+    const __m256i empty = _mm256_set1_epi32(INT_MIN);
+    size_t empties = 0;
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p+i)),empty);
+        empties += popcount(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(eq)))); // one bit per lane
+    }
+    return i-empties+present_count_scalar(p+i,n-i);
+}
+
+// INT_MIN (that is, empty) if no value is present; one pass: presence is tracked along with the minimum
+__attribute__((target("avx2"))) inline int present_min_avx2(const int* p, size_t n)
+{
+    const __m256i empty = _mm256_set1_epi32(INT_MIN);
+    const __m256i biggest = _mm256_set1_epi32(INT_MAX);
+    __m256i lo = biggest;
+    __m256i seen = _mm256_setzero_si256(); // a lane is all ones once a value was present in it
+    size_t i = 0;
+    for (; i+8<=n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p+i));
+        __m256i eq = _mm256_cmpeq_epi32(x,empty);
+        lo = _mm256_min_epi32(lo,_mm256_blendv_epi8(x,biggest,eq)); // empties become INT_MAX: they can't win
+        seen = _mm256_or_si256(seen,_mm256_xor_si256(eq,_mm256_set1_epi32(-1)));
+    }
+    bool present = !_mm256_testz_si256(seen,seen);
+    int l[8];
+    _mm256_storeu_si256((__m256i*)l,lo);
+    int m = *min_element(l,l+8);
+    for (; i<n; ++i) // the tail
+        if (p[i]!=INT_MIN) {
+            present = true;
+            m = min(m,p[i]);
+        }
+    return present ? m : INT_MIN; // (INT_MAX could be a value, so it can't mean "none")
+}
+
+#endif
+
+} // namespace bulk
+
+template<typename T, typename S>
+long long present_sum(span<const compact_optional<T,S>> s) // the sum of the values present
+{
+#if defined(__x86_64__)
+    if constexpr (is_same_v<T,int> && is_same_v<S,Min_sentinel<int>>)
+        if (bulk::active==bulk::Isa::avx2)
+            return bulk::present_sum_avx2(reinterpret_cast<const int*>(s.data()),s.size());
+#endif
+    long long sum = 0;
+    for (auto x : s)
+        if (x) sum += *x;
+    return sum;
+}
+
+template<typename T, typename S>
+size_t count_present(span<const compact_optional<T,S>> s)
+{
+#if defined(__x86_64__)
+    if constexpr (is_same_v<T,int> && is_same_v<S,Min_sentinel<int>>)
+        if (bulk::active==bulk::Isa::avx2)
+            return bulk::present_count_avx2(reinterpret_cast<const int*>(s.data()),s.size());
+#endif
+    return count_if(s.begin(),s.end(),[](auto x) { return x.has_value(); });
+}
+
+template<typename T, typename S>
+compact_optional<T,S> present_min(span<const compact_optional<T,S>> s) // empty if no value is present
+{
+    compact_optional<T,S> m;
+#if defined(__x86_64__)
+    if constexpr (is_same_v<T,int> && is_same_v<S,Min_sentinel<int>>)
+        if (bulk::active==bulk::Isa::avx2)
+            return bulk::present_min_avx2(reinterpret_cast<const int*>(s.data()),s.size()); // INT_MIN: empty
+#endif
+    for (auto x : s)
+        if (x && (!m || *x<*m)) m = x;
+    return m;
+}
+
+// benchmark: memory and sum/count/min over n values, about 1 in 10 of them missing
+void bench_compact_optional(size_t n = 10'000'000, int reps = 10)
+{
+    vector<optional<int>> vo(n);
+    vector<compact_optional<int>> vc(n);
+    mt19937 gen;
+    for (size_t i = 0; i<n; ++i) {
+        if (gen()%10==0) continue;
+        int x = int(gen()%2'000'001)-1'000'000;
+        vo[i] = x;
+        vc[i] = x;
+    }
+    cout << "vector<optional<int>>:         " << n*sizeof(optional<int>)/(1<<20) << " MB\n";
+    cout << "vector<compact_optional<int>>: " << n*sizeof(compact_optional<int>)/(1<<20) << " MB\n";
+
+    auto time = [&](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        long long check = 0;
+        for (int r = 0; r<reps; ++r) check += run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/(reps*n) << " ns per element (" << check/reps << ")\n";
+    };
+
+    span<const compact_optional<int>> sc {vc};
+    time("optional sum:           ",[&] { long long s = 0; for (auto x : vo) if (x) s += *x; return s; });
+    time("compact_optional sum:   ",[&] { return present_sum(sc); });
+    time("optional count:         ",[&] { return count_if(vo.begin(),vo.end(),[](auto x) { return x.has_value(); }); });
+    time("compact_optional count: ",[&] { return count_present(sc); });
+    time("optional min:           ",[&] { int m = INT_MAX; for (auto x : vo) if (x) m = min(m,*x); return m; });
+    time("compact_optional min:   ",[&] { return *present_min(sc); });
+}
+
 // 15.4.3 any
 // an any can hold an arbitrary type and know which type (if any) it holds
 // it's like an unconstraine version of variant
@@ -700,4 +5471,431 @@ auto m = compose_message(cin);
 string& s = any_cast<string>(m);
 cout << s;
 
-// if we try to access an any holding a different type than expected, bad_any_access is thrown
\ No newline at end of file
+// if we try to access an any holding a different type than expected, bad_any_access is thrown
+
+// what does the any above cost?
+// the any has to store a value of a type it doesn't know in advance; a big value goes on the free store
+// how big is "big" is up to the implementation: libstdc++ keeps only values of at most sizeof(void*) inside the any,
+// so every string returned by compose_message() costs an allocation, even a short one that needs no allocation of its own
+// and any_cast compares typeid()s, which may mean comparing type names
+
+// Small_any<Size,Copyable> is an any with a buffer of Size bytes inside it: anything that fits (and can be moved without throwing) is kept there
+// the type is identified by the address of a static variable made for each type: comparing two pointers
+// (that's one address per program; with shared libraries, each library may have its own copy, so don't compare across them)
+// Copyable==false gives a move-only any, which can also hold move-only types, like unique_ptr
+
+template<typename T>
+struct Type_tag {
+    static constexpr char tag = 0;
+};
+
+template<typename T>
+constexpr const void* type_id_of = &Type_tag<T>::tag; // a different address for each T
+
+template<size_t Size = 32, bool Copyable = true>
+class Small_any {
+public:
+    Small_any() = default;
+
+    template<typename T>
+        requires (!is_same_v<decay_t<T>,Small_any> && (!Copyable || copy_constructible<decay_t<T>>))
+    Small_any(T&& x) { emplace<decay_t<T>>(forward<T>(x)); }
+
+    Small_any(const Small_any& a) requires Copyable
+    {
+        if (a.ops) a.ops->copy(a,*this);
+    }
+    Small_any(Small_any&& a) noexcept
+    {
+        if (a.ops) a.ops->move(a,*this);
+    }
+    Small_any& operator=(const Small_any& a) requires Copyable
+    {
+        if (this!=&a) {
+            Small_any tmp {a}; // if the copy throws, *this is unchanged
+            *this = move(tmp);
+        }
+        return *this;
+    }
+    Small_any& operator=(Small_any&& a) noexcept
+    {
+        if (this!=&a) {
+            reset();
+            if (a.ops) a.ops->move(a,*this);
+        }
+        return *this;
+    }
+    ~Small_any() { reset(); }
+
+    template<typename T, typename... Args>
+    T& emplace(Args&&... args)
+    {
+        reset();
+        T* p;
+        if constexpr (fits_inline<T>)
+            p = new(buf) T(forward<Args>(args)...);
+        else
+            heap = p = new T(forward<Args>(args)...);
+        ops = &ops_for<T>;
+        return *p;
+    }
+
+    void reset() noexcept
+    {
+        if (ops) {
+            ops->destroy(*this);
+            ops = nullptr;
+        }
+    }
+
+    bool has_value() const { return ops!=nullptr; }
+    const void* type() const { return ops ? ops->type : nullptr; } // compare with type_id_of<T>
+
+    template<typename T>
+    T* get_if() { return ops && ops->type==type_id_of<T> ? ptr<T>() : nullptr; } // like any_cast<T>(&a)
+    template<typename T>
+    const T* get_if() const { return ops && ops->type==type_id_of<T> ? ptr<T>() : nullptr; }
+
+    template<typename T>
+    T& get() // like any_cast<T&>(a)
+    {
+        if (T* p = get_if<T>()) return *p;
+        throw bad_any_cast{};
+    }
+    template<typename T>
+    const T& get() const
+    {
+        if (const T* p = get_if<T>()) return *p;
+        throw bad_any_cast{};
+    }
+
+    template<typename T>
+    static constexpr bool fits_inline = sizeof(T)<=Size && alignof(T)<=alignof(max_align_t) && is_nothrow_move_constructible_v<T>;
+private:
+    struct Ops { // one for each type held
+        const void* type;
+        void (*destroy)(Small_any&) noexcept;
+        void (*copy)(const Small_any& from, Small_any& to); // nullptr for a move-only Small_any
+        void (*move)(Small_any& from, Small_any& to) noexcept; // leaves from empty
+    };
+
+    template<typename T>
+    T* ptr() { if constexpr (fits_inline<T>) return std::launder(reinterpret_cast<T*>(buf)); else return static_cast<T*>(heap); }
+    template<typename T>
+    const T* ptr() const { return const_cast<Small_any*>(this)->ptr<T>(); }
+
+    template<typename T>
+    static constexpr Ops ops_for {
+        type_id_of<T>,
+        [](Small_any& a) noexcept {
+            if constexpr (fits_inline<T>) a.ptr<T>()->~T();
+            else delete a.ptr<T>();
+        },
+        [] {
+            void (*copy)(const Small_any&, Small_any&) = nullptr;
+            if constexpr (Copyable)
+                copy = [](const Small_any& from, Small_any& to) { to.emplace<T>(*from.ptr<T>()); };
+            return copy;
+        }(),
+        [](Small_any& from, Small_any& to) noexcept {
+            if constexpr (fits_inline<T>) {
+                new(to.buf) T(std::move(*from.ptr<T>()));
+                from.ptr<T>()->~T();
+            }
+            else
+                to.heap = from.heap; // just take the pointer
+            to.ops = from.ops;
+            from.ops = nullptr;
+        },
+    };
+
+    const Ops* ops = nullptr; // nullptr: empty
+    union {
+        alignas(max_align_t) byte buf[Size];
+        void* heap;
+    };
+};
+
+using Unique_any = Small_any<32,false>; // move-only
+
+static_assert(Small_any<>::fits_inline<string>); // libstdc++ and libc++: a 32-byte (or smaller) string
+static_assert(Unique_any::fits_inline<unique_ptr<int>>);
+
+Small_any<> compose_message2(istream& s)
+{
+    string mess;
+    // ... read from s and compose message ...
+    if(no_problems)
+        return mess; // a string, kept inside the Small_any
+    else
+        return error_number; // an int
+}
+
+void user4()
+{
+    auto m = compose_message2(cin);
+    if (auto p = m.get_if<string>())
+        cout << *p;
+    else
+        cerr << "error " << m.get<int>(); // throws bad_any_cast (the standard name for the error above) if m holds neither
+}
+
+// did it allocate? alloc_test.cpp (notes_alloc_test, and ctest) answers that by counting: it replaces the global operator new,
+// which is a decision for all of a program, so it's a program of its own and the benchmarks here allocate the usual way
+// here, a quicker look at where the value is: if its address is inside the object that holds it, no allocation was made for it
+// (a short string keeps its characters inside itself, too: the small string optimization)
+// that shows where the value is, not that nothing else was allocated on the side; the count shows that
+
+template<typename Holder>
+bool stored_inline(const Holder& h, const void* value)
+{
+    auto first = reinterpret_cast<uintptr_t>(&h);
+    auto p = reinterpret_cast<uintptr_t>(value);
+    return first<=p && p<first+sizeof(Holder);
+}
+
+void check_any_storage()
+{
+    string fish = "Herring"; // short enough not to need an allocation of its own
+    if (!stored_inline(fish,fish.data()))
+        throw logic_error{"check_any_storage: no small string optimization"};
+
+    any a = fish;
+    any b = a;
+    Small_any<> c = fish;
+    Small_any<> d = c;
+    Unique_any e = fish;
+    Unique_any f = move(e);
+
+    auto where = [](bool in) { return in ? "inside the object\n" : "on the free store: one allocation\n"; };
+    cout << "any:          " << where(stored_inline(b,any_cast<string>(&b))); // on the free store with libstdc++, for a and for b
+    cout << "Small_any:    " << where(stored_inline(d,d.get_if<string>()));
+    cout << "Unique_any:   " << where(stored_inline(f,f.get_if<string>()));
+    if (!stored_inline(c,c.get_if<string>()) || !stored_inline(d,d.get_if<string>()) || !stored_inline(f,f.get_if<string>()))
+        throw logic_error{"Small_any: a value that fits inline was allocated"};
+
+    Small_any<8> big = fish; // too big for 8 bytes
+    cout << "Small_any<8>: " << where(stored_inline(big,big.get_if<string>()));
+}
+
+// benchmark: construct, cast, and destroy n messages, as a string or an int
+void bench_any(int n = 10'000'000)
+{
+    auto time = [n](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        size_t check = run();
+        chrono::duration<double,nano> d = chrono::steady_clock::now()-t0;
+        cout << label << d.count()/n << " ns per message (" << check << ")\n";
+    };
+
+    time("any:        ",[&] {
+        size_t sum = 0;
+        for (int i = 0; i<n; ++i) {
+            any m = (i%8) ? any{string{"Herring"}} : any{i};
+            if (auto p = any_cast<string>(&m)) sum += p->size();
+            else sum += any_cast<int>(m);
+        }
+        return sum;
+    });
+
+    time("Small_any:  ",[&] {
+        size_t sum = 0;
+        for (int i = 0; i<n; ++i) {
+            Small_any<> m = (i%8) ? Small_any<>{string{"Herring"}} : Small_any<>{i};
+            if (auto p = m.get_if<string>()) sum += p->size();
+            else sum += m.get<int>();
+        }
+        return sum;
+    });
+
+    time("Unique_any: ",[&] {
+        size_t sum = 0;
+        for (int i = 0; i<n; ++i) {
+            Unique_any m = (i%8) ? Unique_any{string{"Herring"}} : Unique_any{i};
+            if (auto p = m.get_if<string>()) sum += p->size();
+            else sum += m.get<int>();
+        }
+        return sum;
+    });
+}
+
+// all three compose_message()s build a new string for each message:
+// at least one allocation (unless the message is short) and a copy out of the stream's buffer, for every message
+// when messages come one after another from a file or a socket, we can do better:
+// read big chunks into one buffer that we reuse, and hand out string_views into it
+
+// Message_reader returns one message per call to next(): a line (without its '\n'), or an Error_code
+// the string_view is valid until the next call of next(); copy it to a string if it must live longer
+// at the end of the input, next() returns Error_code::not_found
+// a message that doesn't fit in the buffer gives Error_code{some_problem}, and the reader skips to the next message
+
+// the sources:
+//   a file descriptor (a file, a pipe, a socket): read() into the buffer;
+//     the start of the unread data moves round the buffer, and only the tail of a partial message is moved back to the front
+//   a Mapped_file: no buffer at all, the messages point straight into the mapped pages;
+//     only a message that straddles two windows is copied, into the same reusable buffer
+
+class Message_reader {
+public:
+    explicit Message_reader(int fd, size_t capacity = 1<<16) // fd is not closed by the reader
+        : fd{fd}, buf(capacity) {}
+
+    explicit Message_reader(Mapped_file& mf) // mf must outlive the reader
+        : mf{&mf}, window{mf.text()} {}
+
+    variant<string_view,Error_code> next()
+    {
+        return mf ? next_mapped() : next_read();
+    }
+private:
+    variant<string_view,Error_code> next_read()
+    {
+        for (;;) {
+            if (auto nl = static_cast<char*>(memchr(buf.data()+first,'\n',last-first))) {
+                size_t start = exchange(first,nl-buf.data()+1);
+                if (skipping) { // the rest of a message that was too long
+                    skipping = false;
+                    continue;
+                }
+                return string_view{buf.data()+start,size_t(nl-buf.data())-start};
+            }
+            if (eof) {
+                if (skipping) { // the input ended inside a message that was too long: its error has been reported
+                    skipping = false;
+                    first = last;
+                }
+                if (first==last)
+                    return Error_code::not_found;
+                size_t start = exchange(first,last); // a last message without a '\n'
+                return string_view{buf.data()+start,last-start};
+            }
+            if (first>0) { // move the partial message to the front, to make room after it
+                memmove(buf.data(),buf.data()+first,last-first);
+                last -= first;
+                first = 0;
+            }
+            if (last==buf.size()) { // a message longer than the buffer: drop what we have, skip the rest
+                first = last = 0;
+                bool was_skipping = exchange(skipping,true);
+                if (!was_skipping)
+                    return Error_code{some_problem};
+            }
+            ssize_t n = ::read(fd,buf.data()+last,buf.size()-last);
+            if (n<0) {
+                if (errno==EINTR) continue;
+                return Error_code{some_problem};
+            }
+            if (n==0) eof = true;
+            last += n;
+        }
+    }
+
+    variant<string_view,Error_code> next_mapped()
+    {
+        if (auto nl = window.find('\n'); nl!=string_view::npos) { // the usual case: no copy
+            auto m = window.substr(0,nl);
+            window.remove_prefix(nl+1);
+            return m;
+        }
+        // the message continues in the next window (or it's the last one, without a '\n')
+        buf.assign(window.begin(),window.end());
+        window = {};
+        while (mf->next()) {
+            window = mf->text();
+            auto nl = window.find('\n');
+            buf.insert(buf.end(),window.begin(),window.begin()+min(nl,window.size()));
+            if (nl!=string_view::npos) {
+                window.remove_prefix(nl+1);
+                return string_view{buf.data(),buf.size()};
+            }
+            window = {};
+        }
+        if (buf.empty())
+            return Error_code::not_found;
+        return string_view{buf.data(),buf.size()};
+    }
+
+    int fd = -1;
+    Mapped_file* mf = nullptr;
+    string_view window; // the unread part of mf's current window
+    vector<char> buf;
+    size_t first = 0; // the unread data is buf[first:last)
+    size_t last = 0;
+    bool eof = false;
+    bool skipping = false;
+};
+
+void user5(const string& name)
+{
+    Mapped_file mf {name};
+    Message_reader messages {mf};
+    for (;;) {
+        auto m = messages.next();
+        if (auto p = get_if<string_view>(&m)) {
+            cout << *p << '\n'; // no copy, no allocation
+            continue;
+        }
+        if (get<Error_code>(m)==Error_code::not_found) // the end
+            break;
+        // .. handle error
+    }
+}
+
+// benchmark: n messages (lines of 10 to 80 characters) read with a string-returning compose_message()
+// and with Message_reader from a file descriptor and from a Mapped_file
+
+variant<string,Error_code> compose_message_line(istream& s) // the string-returning version, for comparison
+{
+    string mess;
+    if (getline(s,mess))
+        return mess;
+    return Error_code::not_found;
+}
+
+void bench_messages(size_t n = 10'000'000)
+{
+    auto name = (filesystem::temp_directory_path()/"notes_messages.txt").string();
+    {
+        ofstream out {name};
+        mt19937 gen;
+        for (size_t i = 0; i<n; ++i)
+            out << string(10+gen()%71,'a'+char(i%26)) << '\n';
+    }
+
+    auto time = [n](const char* label, auto run) {
+        auto t0 = chrono::steady_clock::now();
+        size_t total = run();
+        chrono::duration<double> d = chrono::steady_clock::now()-t0;
+        cout << label << n/d.count()/1e6 << " million messages/s (" << total << " characters)\n";
+    };
+
+    time("istream, string:      ",[&] {
+        ifstream in {name};
+        size_t total = 0;
+        for (auto m = compose_message_line(in); holds_alternative<string>(m); m = compose_message_line(in))
+            total += get<string>(m).size();
+        return total;
+    });
+
+    time("Message_reader, fd:   ",[&] {
+        int fd = ::open(name.c_str(),O_RDONLY);
+        if (fd<0) throw No_file{};
+        Message_reader messages {fd};
+        size_t total = 0;
+        for (auto m = messages.next(); holds_alternative<string_view>(m); m = messages.next())
+            total += get<string_view>(m).size();
+        ::close(fd);
+        return total;
+    });
+
+    time("Message_reader, mmap: ",[&] {
+        Mapped_file mf {name};
+        Message_reader messages {mf};
+        size_t total = 0;
+        for (auto m = messages.next(); holds_alternative<string_view>(m); m = messages.next())
+            total += get<string_view>(m).size();
+        return total;
+    });
+
+    filesystem::remove(name);
+}
\ No newline at end of file